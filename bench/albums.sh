@@ -0,0 +1,32 @@
+#!/bin/sh
+# Split a few synthetic albums at once, as a whole run of flacsplit, and
+# report albums per minute. ALBUMS, LENGTH (of each, in seconds), JOBS and
+# FLAGS (more of flacsplit's options, e.g. `--fast' or `-f' for the FLAC
+# images) can be set in the environment.
+set -e
+
+ALBUMS=${ALBUMS:-4}
+LENGTH=${LENGTH:-600}
+JOBS=${JOBS:-0}
+FLAGS=${FLAGS:-}
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/flacsplit-albums-XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+
+cues=
+for i in $(seq "$ALBUMS"); do
+	bench/make_corpus --flac --seconds "$LENGTH" --seed "$i" \
+	    --title "Album $i" "$dir/album$i"
+	cues="$cues $dir/album$i.cue"
+done
+
+start=$(date +%s.%N)
+# shellcheck disable=SC2086
+./flacsplit -j "$JOBS" $FLAGS -O "$dir/out" $cues >/dev/null
+end=$(date +%s.%N)
+
+awk -v albums="$ALBUMS" -v seconds="$LENGTH" -v start="$start" \
+    -v end="$end" 'BEGIN {
+	printf "%d albums of %d s in %.2f s: %.2f albums/minute\n",
+	    albums, seconds, end - start, albums * 60 / (end - start)
+}'
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <regex>
+#include <sstream>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include "bench/bench.hpp"
+#include "errors.hpp"
+
+const char *prog;
+
+flacsplit::bench::State::State(const std::vector<int64_t> &args,
+    uint64_t iterations) :
+	_args(args),
+	_iterations(iterations),
+	_done(0),
+	_start(),
+	_elapsed(),
+	_bytes(0),
+	_items(0),
+	_counters(),
+	_skipped()
+{}
+
+flacsplit::bench::Benchmark::Benchmark(const std::string &name,
+    Function function, std::initializer_list<std::vector<int64_t>> args) :
+	_name(name),
+	_function(function),
+	_args(args)
+{
+	registry().push_back(this);
+}
+
+const std::vector<const flacsplit::bench::Benchmark *> &
+flacsplit::bench::Benchmark::all() {
+	return registry();
+}
+
+std::vector<const flacsplit::bench::Benchmark *> &
+flacsplit::bench::Benchmark::registry() {
+	// constructed on first use, since benchmarks register from other
+	// translation units' static initialization
+	static std::vector<const Benchmark *> benchmarks;
+	return benchmarks;
+}
+
+namespace flacsplit {
+namespace bench {
+
+class Scratch_dir {
+public:
+	Scratch_dir() : _path() {
+		std::string tmpl = (std::filesystem::temp_directory_path() /
+		    "flacsplit-bench-XXXXXX").string();
+		if (!mkdtemp(tmpl.data()))
+			throw_traced(Unix_error("making scratch directory"));
+		_path = tmpl;
+	}
+
+	~Scratch_dir() {
+		std::error_code ec;
+		std::filesystem::remove_all(_path, ec);
+	}
+
+	const std::filesystem::path &path() const {
+		return _path;
+	}
+
+private:
+	std::filesystem::path	_path;
+};
+
+//! Runs each benchmark long enough to time, and reports it.
+class Runner {
+public:
+	Runner(const std::regex &filter, double min_time) :
+		_filter(filter),
+		_min_time(min_time)
+	{}
+
+	//! \return	Whether every benchmark ran without throwing
+	bool run_all();
+
+private:
+	bool run(const Benchmark &, const std::vector<int64_t> &args);
+
+	std::regex	_filter;
+	double		_min_time;
+};
+
+}
+}
+
+namespace {
+
+std::string
+full_name(const flacsplit::bench::Benchmark &benchmark,
+    const std::vector<int64_t> &args) {
+	std::string name = benchmark.name();
+	for (int64_t arg : args)
+		name += "/" + std::to_string(arg);
+	return name;
+}
+
+//! \a per_second with a prefix, binary for bytes (e.g. "12.3 Mi") and
+//! decimal for anything else (e.g. "12.3 M").
+std::string
+rate(double per_second, bool binary) {
+	const char *const BINARY[] = {"", "Ki", "Mi", "Gi", "Ti"};
+	const char *const DECIMAL[] = {"", "k", "M", "G", "T"};
+	double base = binary ? 1024 : 1000;
+	size_t i = 0;
+	while (per_second >= base && i + 1 < std::size(BINARY)) {
+		per_second /= base;
+		i++;
+	}
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1) << per_second << ' '
+	    << (binary ? BINARY : DECIMAL)[i];
+	return out.str();
+}
+
+void
+usage(const boost::program_options::options_description &desc) {
+	std::cout << "Usage: " << prog << " [OPTIONS...]\n" << desc;
+}
+
+} // end anon
+
+bool
+flacsplit::bench::Runner::run_all() {
+	std::cout << std::left << std::setw(40) << "Benchmark"
+	    << std::right << std::setw(14) << "Time"
+	    << std::setw(12) << "Iterations" << "  Throughput\n"
+	    << std::string(80, '-') << '\n';
+
+	bool ok = true;
+	for (const Benchmark *benchmark : Benchmark::all())
+		for (const std::vector<int64_t> &args : benchmark->args())
+			if (std::regex_search(full_name(*benchmark, args),
+			    _filter))
+				ok &= run(*benchmark, args);
+	return ok;
+}
+
+bool
+flacsplit::bench::Runner::run(const Benchmark &benchmark,
+    const std::vector<int64_t> &args) {
+	std::string name = full_name(benchmark, args);
+	std::cout << std::left << std::setw(40) << name << std::flush;
+
+	uint64_t iterations = 1;
+	for (;;) {
+		State state(args, iterations);
+		try {
+			benchmark.function()(state);
+		} catch (const std::exception &e) {
+			std::cout << "  failed: " << e.what() << '\n';
+			return false;
+		}
+		if (!state._skipped.empty()) {
+			std::cout << "  skipped: " << state._skipped << '\n';
+			return true;
+		}
+
+		double seconds = std::chrono::duration<double>(
+		    state._elapsed).count();
+		if (seconds < _min_time && iterations < 1000000000) {
+			// aim past the minimum, so it's usually the last round,
+			// but don't trust a time too short to go by
+			double scale = seconds > 0 ?
+			    _min_time * 1.4 / seconds : 10;
+			iterations = static_cast<uint64_t>(
+			    iterations * std::clamp(scale, 2.0, 10.0));
+			continue;
+		}
+
+		std::cout << std::right << std::setw(11) << std::fixed
+		    << std::setprecision(0) << seconds * 1e9 / iterations
+		    << " ns" << std::setw(12) << iterations;
+		if (state._bytes)
+			std::cout << "  " << rate(state._bytes / seconds, true)
+			    << "B/s";
+		if (state._items)
+			std::cout << "  " << rate(state._items / seconds, false)
+			    << "items/s";
+		for (const auto &[counter, value] : state._counters)
+			std::cout << "  " << counter << '='
+			    << std::setprecision(3) << std::defaultfloat
+			    << value;
+		std::cout << '\n';
+		return true;
+	}
+}
+
+const std::filesystem::path &
+flacsplit::bench::scratch_dir() {
+	static Scratch_dir dir;
+	return dir.path();
+}
+
+int
+main(int argc, char **argv) {
+	using namespace flacsplit::bench;
+
+	namespace po = boost::program_options;
+
+	prog = *argv;
+
+	po::options_description desc("Options");
+	desc.add_options()
+	    ("filter", po::value<std::string>()->default_value(""),
+		"run only the benchmarks whose names match this regular "
+		"expression, e.g. `decode/'")
+	    ("help", "show this message")
+	    ("list", "list the benchmarks instead of running them")
+	    ("min_time", po::value<double>()->default_value(0.5),
+		"how long to run each benchmark for at least, in seconds")
+	    ;
+
+	po::variables_map var_map;
+	try {
+		po::store(po::parse_command_line(argc, argv, desc), var_map);
+	} catch (const po::error &e) {
+		std::cerr << prog << ": " << e.what() << '\n';
+		return 1;
+	}
+
+	if (!var_map["help"].empty()) {
+		usage(desc);
+		return 0;
+	}
+
+	std::regex filter;
+	try {
+		filter = std::regex(var_map["filter"].as<std::string>());
+	} catch (const std::regex_error &e) {
+		std::cerr << prog << ": bad --filter: " << e.what() << '\n';
+		return 1;
+	}
+
+	if (!var_map["list"].empty()) {
+		for (const Benchmark *benchmark : Benchmark::all())
+			for (const auto &args : benchmark->args())
+				std::cout << full_name(*benchmark, args)
+				    << '\n';
+		return 0;
+	}
+
+	Runner runner(filter, var_map["min_time"].as<double>());
+	return runner.run_all() ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#ifndef FLACSPLIT_BENCH_BENCH_HPP
+#define FLACSPLIT_BENCH_BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace flacsplit {
+namespace bench {
+
+/** What a benchmark is handed: its arguments, and the loop to time.
+ *
+ *	while (state.keep_running()) {
+ *		...
+ *	}
+ *
+ * The loop runs as many times as it takes to fill the minimum time, and
+ * what it's timed by is divided by that.
+ */
+class State {
+public:
+	State(const std::vector<int64_t> &args, uint64_t iterations);
+
+	//! Whether to go round again; the first call starts the clock.
+	bool keep_running() {
+		if (_done == _iterations) {
+			stop_clock();
+			return false;
+		}
+		if (!_done++)
+			start_clock();
+		return true;
+	}
+
+	//! Leave what follows out of the time, e.g. rewinding a decoder.
+	void pause() {
+		stop_clock();
+	}
+
+	void resume() {
+		start_clock();
+	}
+
+	int64_t arg(size_t i) const {
+		return _args.at(i);
+	}
+
+	uint64_t iterations() const {
+		return _iterations;
+	}
+
+	//! How many bytes the whole loop went through, for a throughput.
+	void set_bytes(uint64_t bytes) {
+		_bytes = bytes;
+	}
+
+	//! How many items (samples, strings) the whole loop went through.
+	void set_items(uint64_t items) {
+		_items = items;
+	}
+
+	//! A figure of its own to report, as it is, e.g. a compressed size.
+	double &counter(const std::string &name) {
+		return _counters[name];
+	}
+
+	//! For skipping a benchmark that can't run here.
+	void skip(const std::string &why) {
+		_skipped = why;
+	}
+
+private:
+	friend class Runner;
+
+	void start_clock() {
+		_start = std::chrono::steady_clock::now();
+	}
+
+	void stop_clock() {
+		if (_start == std::chrono::steady_clock::time_point())
+			return;
+		_elapsed += std::chrono::steady_clock::now() - _start;
+		_start = std::chrono::steady_clock::time_point();
+	}
+
+	const std::vector<int64_t>	&_args;
+	uint64_t			_iterations;
+	uint64_t			_done;
+	std::chrono::steady_clock::time_point
+					_start;
+	std::chrono::steady_clock::duration
+					_elapsed;
+	uint64_t			_bytes;
+	uint64_t			_items;
+	std::map<std::string, double>	_counters;
+	std::string			_skipped;
+};
+
+/** A benchmark, registered for the runner by being constructed; define
+ * them at namespace scope. It's run once for each set of arguments.
+ */
+class Benchmark {
+public:
+	typedef std::function<void(State &)>	Function;
+
+	Benchmark(const std::string &name, Function function,
+	    std::initializer_list<std::vector<int64_t>> args={{}});
+
+	//! Every benchmark constructed so far.
+	static const std::vector<const Benchmark *> &all();
+
+	const std::string &name() const {
+		return _name;
+	}
+
+	const Function &function() const {
+		return _function;
+	}
+
+	const std::vector<std::vector<int64_t>> &args() const {
+		return _args;
+	}
+
+private:
+	static std::vector<const Benchmark *> &registry();
+
+	std::string				_name;
+	Function				_function;
+	std::vector<std::vector<int64_t>>	_args;
+};
+
+//! A directory for the benchmarks' files, removed on exit.
+const std::filesystem::path	&scratch_dir();
+
+//! Keep the compiler from optimizing away what \a value was computed from.
+template <typename T>
+inline void
+keep(const T &value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}
+}
+
+#endif
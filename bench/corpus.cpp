@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+
+#include <FLAC++/encoder.h>
+
+#include "bench/corpus.hpp"
+#include "errors.hpp"
+
+namespace {
+
+// how many samples are made and written at a time
+const int64_t BLOCK = 4096;
+
+// tones per channel
+const unsigned TONES = 3;
+
+class File {
+public:
+	//! \throw flacsplit::Unix_error
+	File(const std::filesystem::path &path) :
+		_path(path),
+		_fp(fopen(path.c_str(), "wb"))
+	{
+		if (!_fp)
+			throw_traced(flacsplit::Unix_error(path.string()));
+	}
+
+	~File() {
+		if (_fp)
+			fclose(_fp);
+	}
+
+	//! \throw flacsplit::Unix_error
+	void write(const void *buf, size_t len) {
+		if (fwrite(buf, 1, len, _fp) != len)
+			throw_traced(flacsplit::Unix_error(_path.string()));
+	}
+
+	//! \throw flacsplit::Unix_error
+	void close() {
+		FILE *fp = _fp;
+		_fp = nullptr;
+		if (fclose(fp))
+			throw_traced(flacsplit::Unix_error(_path.string()));
+	}
+
+private:
+	std::filesystem::path	_path;
+	FILE			*_fp;
+};
+
+//! Append \a value to \a out, little-endian, in \a bytes.
+void
+put_le(std::vector<uint8_t> &out, uint32_t value, unsigned bytes) {
+	for (unsigned i = 0; i < bytes; i++)
+		out.push_back(value >> (8 * i));
+}
+
+std::vector<uint8_t>
+wave_header(const flacsplit::bench::Corpus_shape &shape, uint64_t data_len) {
+	const uint16_t WAVE_FORMAT_PCM = 1;
+	const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xfffe;
+	// the subformat GUID's last 14 bytes, after the format tag
+	const uint8_t PCM_GUID_TAIL[] = {
+		0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+		0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+	};
+
+	unsigned block_align = shape.channels * shape.bits / 8;
+	// WAVE wants extensible for anything past 16-bit stereo
+	bool extensible = shape.channels > 2 || shape.bits > 16;
+	uint32_t fmt_len = extensible ? 40 : 16;
+
+	std::vector<uint8_t> out;
+	out.insert(out.end(), {'R', 'I', 'F', 'F'});
+	put_le(out, 4 + 8 + fmt_len + 8 + data_len, 4);
+	out.insert(out.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+	put_le(out, fmt_len, 4);
+	put_le(out, extensible ? WAVE_FORMAT_EXTENSIBLE : WAVE_FORMAT_PCM, 2);
+	put_le(out, shape.channels, 2);
+	put_le(out, shape.rate, 4);
+	put_le(out, shape.rate * block_align, 4);
+	put_le(out, block_align, 2);
+	put_le(out, shape.bits, 2);
+	if (extensible) {
+		uint32_t mask =
+		    shape.channels == 1 ? 0x4 :
+		    shape.channels == 2 ? 0x3 :
+		    shape.channels == 6 ? 0x3f :
+		    0;
+		put_le(out, 22, 2);
+		put_le(out, shape.bits, 2);
+		put_le(out, mask, 4);
+		put_le(out, WAVE_FORMAT_PCM, 2);
+		out.insert(out.end(), std::begin(PCM_GUID_TAIL),
+		    std::end(PCM_GUID_TAIL));
+	}
+	out.insert(out.end(), {'d', 'a', 't', 'a'});
+	put_le(out, data_len, 4);
+	return out;
+}
+
+//! A CD frame (1/75 s) as a cue sheet's MM:SS:FF.
+std::string
+msf(int64_t frame) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%02lld:%02lld:%02lld",
+	    static_cast<long long>(frame / (75 * 60)),
+	    static_cast<long long>(frame / 75 % 60),
+	    static_cast<long long>(frame % 75));
+	return buf;
+}
+
+} // end anon
+
+flacsplit::bench::Signal::Signal(const Corpus_shape &shape) :
+	_shape(shape),
+	// xorshift never leaves 0
+	_state(shape.seed * 2654435761u | 1),
+	_time(0),
+	_tones(shape.channels * TONES)
+{
+	// each tone's pitch and where it starts come from the seed
+	for (Tone &tone : _tones) {
+		tone.freq = 110.0 * (1 + random() % 1024 / 256.0);
+		tone.phase = random() % 1024 / 1024.0;
+	}
+}
+
+void
+flacsplit::bench::Signal::next(int32_t *out, int64_t samples) {
+	const double TAU = 2 * std::numbers::pi;
+	const double full = (1 << (_shape.bits - 1)) - 1;
+
+	for (unsigned c = 0; c < _shape.channels; c++) {
+		int32_t *channel = out + c * samples;
+		std::fill(channel, channel + samples, 0);
+		for (unsigned t = 0; t < TONES; t++) {
+			Tone &tone = _tones[c * TONES + t];
+			// the pitch wanders slowly, once per call
+			double step = tone.freq / _shape.rate *
+			    (1 + 0.05 * std::sin(TAU * _time / (7 + t)));
+			for (int64_t i = 0; i < samples; i++) {
+				channel[i] += static_cast<int32_t>(
+				    0.15 * full * std::sin(TAU * tone.phase));
+				tone.phase += step;
+			}
+			tone.phase -= std::floor(tone.phase);
+		}
+		for (int64_t i = 0; i < samples; i++) {
+			// noise at -40 dB
+			int32_t noise = static_cast<int32_t>(random()) >> 8;
+			channel[i] += static_cast<int32_t>(
+			    noise * full / (100.0 * (1 << 23)));
+		}
+	}
+	_time += static_cast<double>(samples) / _shape.rate;
+}
+
+int64_t
+flacsplit::bench::total_samples(const Corpus_shape &shape) {
+	return std::llround(shape.seconds * 75) * shape.rate / 75;
+}
+
+void
+flacsplit::bench::write_wave(const std::filesystem::path &path,
+    const Corpus_shape &shape) {
+	unsigned bytes = shape.bits / 8;
+	int64_t total = total_samples(shape);
+
+	uint64_t data_len = total * shape.channels * bytes;
+	// RIFF sizes are 32 bits
+	if (data_len > UINT32_MAX - 80)
+		throw_traced(std::runtime_error(path.string() +
+		    ": too long for WAVE"));
+
+	File file(path);
+	std::vector<uint8_t> header = wave_header(shape, data_len);
+	file.write(header.data(), header.size());
+
+	Signal signal(shape);
+	std::vector<int32_t> planar(BLOCK * shape.channels);
+	std::vector<uint8_t> pcm(BLOCK * shape.channels * bytes);
+	for (int64_t done = 0; done < total; ) {
+		int64_t samples = std::min(BLOCK, total - done);
+		signal.next(planar.data(), samples);
+		uint8_t *p = pcm.data();
+		for (int64_t i = 0; i < samples; i++)
+			for (unsigned c = 0; c < shape.channels; c++) {
+				uint32_t sample = planar[c * samples + i];
+				for (unsigned b = 0; b < bytes; b++)
+					*p++ = sample >> (8 * b);
+			}
+		file.write(pcm.data(), p - pcm.data());
+		done += samples;
+	}
+	file.close();
+}
+
+void
+flacsplit::bench::write_flac(const std::filesystem::path &path,
+    const Corpus_shape &shape, unsigned compression_level) {
+	int64_t total = total_samples(shape);
+
+	FLAC::Encoder::File encoder;
+	encoder.set_compression_level(compression_level);
+	encoder.set_channels(shape.channels);
+	encoder.set_bits_per_sample(shape.bits);
+	encoder.set_sample_rate(shape.rate);
+	encoder.set_total_samples_estimate(total);
+	FLAC__StreamEncoderInitStatus status = encoder.init(path.c_str());
+	if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+		throw_traced(std::runtime_error(path.string() + ": " +
+		    FLAC__StreamEncoderInitStatusString[status]));
+
+	Signal signal(shape);
+	std::vector<int32_t> planar(BLOCK * shape.channels);
+	std::vector<const int32_t *> channels(shape.channels);
+	for (int64_t done = 0; done < total; ) {
+		int64_t samples = std::min(BLOCK, total - done);
+		signal.next(planar.data(), samples);
+		for (unsigned c = 0; c < shape.channels; c++)
+			channels[c] = planar.data() + c * samples;
+		if (!encoder.process(channels.data(), samples))
+			throw_traced(std::runtime_error(path.string() + ": " +
+			    encoder.get_state().as_cstring()));
+		done += samples;
+	}
+	if (!encoder.finish())
+		throw_traced(std::runtime_error(path.string() + ": " +
+		    encoder.get_state().as_cstring()));
+}
+
+void
+flacsplit::bench::write_cue(const std::filesystem::path &path,
+    const std::string &image, const std::string &title,
+    const Corpus_shape &shape) {
+	int64_t frames = std::llround(shape.seconds * 75);
+
+	std::string cue = "PERFORMER \"Flacsplit\"\n"
+	    "TITLE \"" + title + "\"\n"
+	    "FILE \"" + image + "\" WAVE\n";
+	for (unsigned i = 0; i < shape.tracks; i++) {
+		char track[64];
+		snprintf(track, sizeof(track),
+		    "  TRACK %02u AUDIO\n    TITLE \"Track %u\"\n",
+		    i + 1, i + 1);
+		cue += track;
+		cue += "    INDEX 01 " + msf(frames * i / shape.tracks) +
+		    "\n";
+	}
+
+	File file(path);
+	file.write(cue.data(), cue.size());
+	file.close();
+}
@@ -0,0 +1,90 @@
+#ifndef FLACSPLIT_BENCH_CORPUS_HPP
+#define FLACSPLIT_BENCH_CORPUS_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace flacsplit {
+namespace bench {
+
+//! The shape of a synthetic album.
+struct Corpus_shape {
+	double		seconds = 3600;
+	unsigned	rate = 44100;
+	//! 16 or 24
+	unsigned	bits = 16;
+	unsigned	channels = 2;
+	unsigned	tracks = 12;
+	//! Albums with different seeds sound different; the same seed
+	//! always gives the same samples.
+	uint32_t	seed = 1;
+};
+
+/** Something like music, made up on the spot: a few drifting tones under
+ * some noise, so that it compresses about as well as the real thing. It's
+ * the same for the same shape, on every run.
+ */
+class Signal {
+public:
+	explicit Signal(const Corpus_shape &);
+
+	//! The next \a samples, planar, one channel after another.
+	void next(int32_t *out, int64_t samples);
+
+private:
+	uint32_t random() {
+		// xorshift32
+		_state ^= _state << 13;
+		_state ^= _state >> 17;
+		_state ^= _state << 5;
+		return _state;
+	}
+
+	struct Tone {
+		double	freq;
+		// in cycles, [0, 1)
+		double	phase;
+	};
+
+	Corpus_shape		_shape;
+	uint32_t		_state;
+	double			_time;
+	// a few for each channel
+	std::vector<Tone>	_tones;
+};
+
+//! How many samples an album of \a shape has, a whole number of CD frames.
+int64_t		total_samples(const Corpus_shape &shape);
+
+/** Write a plain PCM WAVE file, which can't be over 4 GiB.
+ *
+ * \throw std::runtime_error	If it would be
+ * \throw Unix_error
+ */
+void		write_wave(const std::filesystem::path &,
+		    const Corpus_shape &);
+
+/** Write a FLAC file with the same samples as write_wave().
+ *
+ * \param compression_level	As flac(1)'s -0 to -8
+ * \throw std::runtime_error
+ */
+void		write_flac(const std::filesystem::path &,
+		    const Corpus_shape &, unsigned compression_level=5);
+
+/** Write a cue sheet splitting \a image into tracks of even length, each
+ * starting on a CD frame.
+ *
+ * \param title	The album's title, so albums go to directories of their own
+ * \throw Unix_error
+ */
+void		write_cue(const std::filesystem::path &,
+		    const std::string &image, const std::string &title,
+		    const Corpus_shape &);
+
+}
+}
+
+#endif
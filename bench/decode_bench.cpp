@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <tuple>
+
+#include "bench/bench.hpp"
+#include "bench/corpus.hpp"
+#include "decode.hpp"
+#include "errors.hpp"
+
+namespace {
+
+using flacsplit::bench::Benchmark;
+using flacsplit::bench::Corpus_shape;
+using flacsplit::bench::State;
+
+typedef std::unique_ptr<FILE, decltype(&fclose)>	File_ptr;
+
+/** A minute of album in the scratch directory, written the first time
+ * it's asked for.
+ *
+ * \throw flacsplit::Unix_error
+ */
+const std::filesystem::path &
+image(const Corpus_shape &shape, flacsplit::file_format format) {
+	static std::map<std::tuple<unsigned, unsigned, unsigned, bool>,
+	    std::filesystem::path> images;
+
+	bool flac = format == flacsplit::file_format::FLAC;
+	std::filesystem::path &path = images[{shape.rate, shape.bits,
+	    shape.channels, flac}];
+	if (path.empty()) {
+		std::filesystem::path name = flacsplit::bench::scratch_dir() /
+		    std::format("decode-{}-{}-{}.{}", shape.rate, shape.bits,
+		    shape.channels, flac ? "flac" : "wav");
+		if (flac)
+			flacsplit::bench::write_flac(name, shape);
+		else
+			flacsplit::bench::write_wave(name, shape);
+		path = name;
+	}
+	return path;
+}
+
+//! A minute of 16-bit stereo, or the shape the arguments give: the bits per
+//! sample and the number of channels.
+Corpus_shape
+shape_of(const State &state, bool from_args) {
+	Corpus_shape shape;
+	shape.seconds = 60;
+	if (from_args) {
+		shape.bits = state.arg(0);
+		shape.channels = state.arg(1);
+	}
+	return shape;
+}
+
+//! How many reading system calls the process has made, or -1 if the
+//! kernel doesn't say. Reads through io_uring aren't among them.
+int64_t
+read_syscalls() {
+	std::ifstream io("/proc/self/io");
+	std::string key;
+	int64_t value;
+	while (io >> key >> value)
+		if (key == "syscr:")
+			return value;
+	return -1;
+}
+
+//! A minute of 24-bit, 192 kHz stereo FLAC, the kind of image that's
+//! gigabytes long.
+Corpus_shape
+hires_shape() {
+	Corpus_shape shape;
+	shape.seconds = 60;
+	shape.rate = 192000;
+	shape.bits = 24;
+	return shape;
+}
+
+//! Time each next_frame(), starting over at the end.
+void
+decode(State &state, const Corpus_shape &shape, flacsplit::file_format format,
+    unsigned read_frames) {
+	const std::filesystem::path &path = image(shape, format);
+
+	File_ptr fp(fopen(path.c_str(), "rb"), &fclose);
+	if (!fp)
+		throw_traced(flacsplit::Unix_error(path.string()));
+	flacsplit::Decoder decoder(fp.get(), format, read_frames);
+	// the decoder's to close now
+	fp.release();
+
+	uint64_t samples = 0;
+	while (state.keep_running()) {
+		flacsplit::Frame frame = decoder.next_frame(true);
+		if (!frame.samples) {
+			state.pause();
+			decoder.seek(0);
+			state.resume();
+			frame = decoder.next_frame(false);
+		}
+		flacsplit::bench::keep(frame.data[0][0]);
+		samples += frame.samples;
+	}
+	state.set_bytes(samples * shape.channels * shape.bits / 8);
+	state.set_items(samples);
+	state.counter("samples/call") =
+	    static_cast<double>(samples) / state.iterations();
+}
+
+const Benchmark wave_next_frame("decode/wave", [](State &state) {
+	// --read_size's default
+	decode(state, shape_of(state, true), flacsplit::file_format::WAVE, 75);
+}, {{16, 2}, {24, 2}, {16, 6}});
+
+/* What each call costs besides the samples it returns: the same minute of
+ * WAVE, read --read_size CD frames at a time, from 1 (what it used to be) to
+ * 5 s. The argument is the read size.
+ */
+const Benchmark wave_read_size("decode/wave_read_size", [](State &state) {
+	decode(state, shape_of(state, false), flacsplit::file_format::WAVE,
+	    state.arg(0));
+}, {{1}, {5}, {25}, {75}, {375}});
+
+const Benchmark flac_next_frame("decode/flac", [](State &state) {
+	decode(state, shape_of(state, true), flacsplit::file_format::FLAC, 1);
+}, {{16, 2}, {24, 2}, {16, 6}});
+
+/* How many reads it takes to decode a hi-res FLAC image, start to end, for
+ * comparing with decode/stdio_reads.
+ */
+const Benchmark flac_reads("decode/flac_reads", [](State &state) {
+	const std::filesystem::path &path = image(hires_shape(),
+	    flacsplit::file_format::FLAC);
+	if (read_syscalls() < 0) {
+		state.skip("no /proc/self/io");
+		return;
+	}
+
+	File_ptr fp(fopen(path.c_str(), "rb"), &fclose);
+	if (!fp)
+		throw_traced(flacsplit::Unix_error(path.string()));
+	flacsplit::Decoder decoder(fp.get(), flacsplit::file_format::FLAC);
+	fp.release();
+
+	int64_t reads = 0;
+	while (state.keep_running()) {
+		int64_t before = read_syscalls();
+		decoder.seek(0);
+		for (;;) {
+			flacsplit::Frame frame = decoder.next_frame(true);
+			if (!frame.samples)
+				break;
+			flacsplit::bench::keep(frame.data[0][0]);
+		}
+		reads += read_syscalls() - before;
+	}
+	// of the file, as for decode/stdio_reads
+	state.set_bytes(state.iterations() *
+	    std::filesystem::file_size(path));
+	state.counter("reads/pass") =
+	    static_cast<double>(reads) / state.iterations();
+});
+
+/* The same image read as libFLAC's FILE-based decoder reads it: through
+ * stdio's buffer, with fread()s of 4 KiB.
+ */
+const Benchmark stdio_reads("decode/stdio_reads", [](State &state) {
+	const std::filesystem::path &path = image(hires_shape(),
+	    flacsplit::file_format::FLAC);
+	if (read_syscalls() < 0) {
+		state.skip("no /proc/self/io");
+		return;
+	}
+
+	File_ptr fp(fopen(path.c_str(), "rb"), &fclose);
+	if (!fp)
+		throw_traced(flacsplit::Unix_error(path.string()));
+
+	char buf[4096];
+	int64_t reads = 0;
+	uint64_t bytes = 0;
+	while (state.keep_running()) {
+		int64_t before = read_syscalls();
+		rewind(fp.get());
+		while (size_t len = fread(buf, 1, sizeof(buf), fp.get()))
+			bytes += len;
+		reads += read_syscalls() - before;
+	}
+	state.set_bytes(bytes);
+	state.counter("reads/pass") =
+	    static_cast<double>(reads) / state.iterations();
+});
+
+} // end anon
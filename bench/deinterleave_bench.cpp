@@ -0,0 +1,87 @@
+#include <vector>
+
+#include "bench/bench.hpp"
+#include "deinterleave.hpp"
+
+namespace {
+
+using flacsplit::bench::Benchmark;
+using flacsplit::bench::State;
+
+// samples per call: a second, as read at --read_size's default of 75 CD
+// frames
+const int64_t SAMPLES = 44100;
+
+/** Time the conversion of interleaved PCM, as it's read from a WAVE file,
+ * to planar ints. The arguments are the bits per sample and the number of
+ * channels.
+ */
+const Benchmark pcm("deinterleave/pcm", [](State &state) {
+	int bits = state.arg(0);
+	int channels = state.arg(1);
+	int bytes = bits / 8;
+
+	std::vector<uint8_t> in(SAMPLES * channels * bytes);
+	// anything will do, but the same every time
+	for (size_t i = 0; i < in.size(); i++)
+		in[i] = i * 2654435761u >> 24;
+	std::vector<int32_t> out(SAMPLES * channels);
+
+	flacsplit::Pcm_deinterleaver deinterleave =
+	    flacsplit::pcm_deinterleaver(bits, channels);
+	while (state.keep_running()) {
+		deinterleave(in.data(), out.data(), channels, SAMPLES);
+		flacsplit::bench::keep(out.data());
+	}
+	state.set_bytes(state.iterations() * in.size());
+	state.set_items(state.iterations() * SAMPLES);
+}, {{16, 1}, {16, 2}, {24, 2}, {16, 6}});
+
+/** The vector kernels for stereo against the plain loop they replace. The
+ * arguments are the bits per sample and the widest vector instructions
+ * allowed: 0 for none, 1 for SSE2 (or SSSE3, for 24 bits) and 2 for AVX2.
+ */
+const Benchmark pcm_simd("deinterleave/pcm_simd", [](State &state) {
+	int bits = state.arg(0);
+	int bytes = bits / 8;
+
+	std::vector<uint8_t> in(SAMPLES * 2 * bytes);
+	for (size_t i = 0; i < in.size(); i++)
+		in[i] = i * 2654435761u >> 24;
+	std::vector<int32_t> out(SAMPLES * 2);
+
+	flacsplit::Pcm_deinterleaver deinterleave =
+	    flacsplit::pcm_deinterleaver(bits, 2,
+	    static_cast<flacsplit::Simd>(state.arg(1)));
+	while (state.keep_running()) {
+		deinterleave(in.data(), out.data(), 2, SAMPLES);
+		flacsplit::bench::keep(out.data());
+	}
+	state.set_bytes(state.iterations() * in.size());
+	state.set_items(state.iterations() * SAMPLES);
+}, {{16, 0}, {16, 1}, {16, 2}, {24, 0}, {24, 1}, {24, 2}});
+
+/** Time the conversion of libsndfile's interleaved, left-justified ints to
+ * planar ones. The arguments are the number of channels and the widest
+ * vector instructions allowed, as for deinterleave/pcm_simd.
+ */
+const Benchmark ints("deinterleave/int", [](State &state) {
+	int channels = state.arg(0);
+
+	std::vector<int32_t> in(SAMPLES * channels);
+	for (size_t i = 0; i < in.size(); i++)
+		in[i] = i * 2654435761u & 0xffff0000;
+	std::vector<int32_t> out(SAMPLES * channels);
+
+	flacsplit::Int_deinterleaver deinterleave =
+	    flacsplit::int_deinterleaver(channels,
+	    static_cast<flacsplit::Simd>(state.arg(1)));
+	while (state.keep_running()) {
+		deinterleave(in.data(), out.data(), channels, SAMPLES, 16);
+		flacsplit::bench::keep(out.data());
+	}
+	state.set_bytes(state.iterations() * in.size() * sizeof(in[0]));
+	state.set_items(state.iterations() * SAMPLES);
+}, {{2, 0}, {2, 1}, {2, 2}, {6, 2}});
+
+} // end anon
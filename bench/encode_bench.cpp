@@ -0,0 +1,89 @@
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <cuetools/cdtext.h>
+
+#include "bench/bench.hpp"
+#include "bench/corpus.hpp"
+#include "encode.hpp"
+#include "errors.hpp"
+
+namespace {
+
+using flacsplit::bench::Benchmark;
+using flacsplit::bench::State;
+
+// samples per call, about what a FLAC frame holds
+const int64_t SAMPLES = 4096;
+
+// how much is encoded over and over, so the encoder isn't handed the same
+// block every time
+const int64_t BLOCKS = 64;
+
+typedef std::unique_ptr<FILE, decltype(&fclose)>	File_ptr;
+
+/** Time Encoder::add_frame(), into a file in the scratch directory. The
+ * arguments are the compression level and whether to do an exhaustive model
+ * search; the ratio of the file's size to the PCM's is reported, too, so
+ * the levels make a table of time against size to pick --compression by.
+ */
+const Benchmark add_frame("encode/add_frame", [](State &state) {
+	flacsplit::bench::Corpus_shape shape;
+
+	std::vector<int32_t> samples(BLOCKS * SAMPLES * shape.channels);
+	flacsplit::bench::Signal signal(shape);
+	for (int64_t b = 0; b < BLOCKS; b++)
+		signal.next(samples.data() + b * SAMPLES * shape.channels,
+		    SAMPLES);
+	std::vector<const int32_t *> channels(BLOCKS * shape.channels);
+	for (int64_t b = 0; b < BLOCKS; b++)
+		for (unsigned c = 0; c < shape.channels; c++)
+			channels[b * shape.channels + c] = samples.data() +
+			    (b * shape.channels + c) * SAMPLES;
+
+	flacsplit::Encode_options options;
+	options.compression_level = state.arg(0);
+	options.exhaustive_search = state.arg(1);
+
+	std::filesystem::path path = flacsplit::bench::scratch_dir() /
+	    "encode.flac";
+	File_ptr fp(fopen(path.c_str(), "w+b"), &fclose);
+	if (!fp)
+		throw_traced(flacsplit::Unix_error(path.string()));
+	std::unique_ptr<Cdtext, decltype(&cdtext_delete)> cdtext(
+	    cdtext_init(), &cdtext_delete);
+	flacsplit::Music_info track(cdtext.get());
+	uint64_t total = state.iterations() * SAMPLES;
+	flacsplit::Encoder encoder(fp.get(), track, total, shape.rate,
+	    nullptr, options);
+
+	uint64_t b = 0;
+	while (state.keep_running()) {
+		flacsplit::Frame frame{
+			.data=channels.data() + b++ % BLOCKS * shape.channels,
+			.bits_per_sample=static_cast<int>(shape.bits),
+			.channels=static_cast<int>(shape.channels),
+			.samples=SAMPLES,
+			.rate=static_cast<int32_t>(shape.rate)
+		};
+		encoder.add_frame(frame);
+	}
+	encoder.finish();
+	fflush(fp.get());
+
+	uint64_t pcm = total * shape.channels * shape.bits / 8;
+	struct stat st;
+	if (!fstat(fileno(fp.get()), &st))
+		state.counter("ratio") = static_cast<double>(st.st_size) / pcm;
+	state.set_bytes(pcm);
+	state.set_items(total);
+}, {
+	{0, 0}, {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}, {6, 0}, {7, 0}, {8, 0},
+	// the default
+	{8, 1}
+});
+
+} // end anon
@@ -0,0 +1,35 @@
+#include <vector>
+
+#include "bench/bench.hpp"
+#include "bench/corpus.hpp"
+#include "loudness.hpp"
+
+namespace {
+
+using flacsplit::bench::Benchmark;
+using flacsplit::bench::State;
+
+// samples per call, about what a FLAC frame holds
+const int64_t SAMPLES = 4096;
+
+/** Time Analyzer::add() on a block of samples. The arguments are the bits
+ * per sample and the number of channels.
+ */
+const Benchmark analyzer_add("loudness/add", [](State &state) {
+	flacsplit::bench::Corpus_shape shape;
+	shape.bits = state.arg(0);
+	shape.channels = state.arg(1);
+
+	std::vector<int32_t> samples(SAMPLES * shape.channels);
+	flacsplit::bench::Signal(shape).next(samples.data(), SAMPLES);
+	std::vector<const int32_t *> channels(shape.channels);
+	for (unsigned c = 0; c < shape.channels; c++)
+		channels[c] = samples.data() + c * SAMPLES;
+
+	flacsplit::replaygain::Analyzer analyzer(shape.channels, shape.rate);
+	while (state.keep_running())
+		analyzer.add(channels.data(), SAMPLES, shape.bits);
+	state.set_items(state.iterations() * SAMPLES);
+}, {{16, 1}, {16, 2}, {24, 2}, {16, 6}});
+
+} // end anon
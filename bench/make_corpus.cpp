@@ -0,0 +1,128 @@
+#include <exception>
+#include <iostream>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include "bench/corpus.hpp"
+
+const char *prog;
+
+namespace {
+
+void
+usage(const boost::program_options::options_description &desc) {
+	std::cout << "Usage: " << prog << " [OPTIONS...] NAME\n"
+	    << "Write NAME.wav and NAME.cue (and NAME.flac), a synthetic album "
+	    "that's the same\nfor the same options.\n"
+	    << desc;
+}
+
+} // end anon
+
+int
+main(int argc, char **argv) {
+	using namespace flacsplit::bench;
+
+	namespace po = boost::program_options;
+
+	prog = *argv;
+
+	Corpus_shape shape;
+
+	po::options_description visible_desc("Options");
+	visible_desc.add_options()
+	    ("bits", po::value<unsigned>(&shape.bits)->default_value(16),
+		"bits per sample, 16 or 24")
+	    ("channels", po::value<unsigned>(&shape.channels)->
+		default_value(2), "number of channels")
+	    ("compression", po::value<unsigned>()->default_value(5),
+		"FLAC compression level, 0 to 8")
+	    ("flac", "write NAME.flac too")
+	    ("help", "show this message")
+	    ("rate", po::value<unsigned>(&shape.rate)->default_value(44100),
+		"sample rate in Hz, a multiple of 75")
+	    ("seconds", po::value<double>(&shape.seconds)->
+		default_value(3600), "length of the album")
+	    ("seed", po::value<uint32_t>(&shape.seed)->default_value(1),
+		"what makes albums of the same shape differ")
+	    ("title", po::value<std::string>(),
+		"the album's title; NAME by default")
+	    ("tracks", po::value<unsigned>(&shape.tracks)->default_value(12),
+		"number of tracks, all the same length")
+	    ;
+
+	po::options_description hidden_desc;
+	hidden_desc.add_options()
+	    ("name", po::value<std::string>())
+	    ;
+
+	po::positional_options_description pos_desc;
+	pos_desc.add("name", 1);
+
+	po::options_description desc;
+	desc.add(visible_desc).add(hidden_desc);
+
+	po::variables_map var_map;
+	try {
+		po::store(po::command_line_parser(argc, argv).
+		    options(desc).positional(pos_desc).run(), var_map);
+		po::notify(var_map);
+	} catch (const po::error &e) {
+		std::cerr << prog << ": " << e.what() << '\n';
+		return 1;
+	}
+
+	if (!var_map["help"].empty()) {
+		usage(visible_desc);
+		return 0;
+	} else if (var_map["name"].empty()) {
+		usage(visible_desc);
+		return 1;
+	}
+
+	if (shape.bits != 16 && shape.bits != 24) {
+		std::cerr << prog << ": --bits must be 16 or 24\n";
+		return 1;
+	}
+	if (!shape.channels || shape.channels > 8) {
+		std::cerr << prog << ": --channels must be 1 to 8\n";
+		return 1;
+	}
+	// so that every CD frame starts on a sample
+	if (!shape.rate || shape.rate % 75) {
+		std::cerr << prog << ": --rate must be a multiple of 75\n";
+		return 1;
+	}
+	if (!shape.tracks || shape.tracks > 99 ||
+	    shape.seconds * 75 < shape.tracks) {
+		std::cerr << prog << ": --tracks must be 1 to 99, and no "
+		    "more than the album's CD frames\n";
+		return 1;
+	}
+
+	std::filesystem::path name = var_map["name"].as<std::string>();
+	std::string title = var_map["title"].empty() ?
+	    name.filename().string() : var_map["title"].as<std::string>();
+	std::filesystem::path wave = name;
+	wave += ".wav";
+	std::filesystem::path cue = name;
+	cue += ".cue";
+
+	try {
+		write_wave(wave, shape);
+		if (!var_map["flac"].empty()) {
+			std::filesystem::path flac = name;
+			flac += ".flac";
+			write_flac(flac, shape,
+			    var_map["compression"].as<unsigned>());
+		}
+		write_cue(cue, wave.filename().string(), title, shape);
+	} catch (const std::exception &e) {
+		std::cerr << prog << ": " << e.what() << '\n';
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+#include <iterator>
+#include <string>
+
+#include "bench/bench.hpp"
+#include "sanitize.hpp"
+
+namespace {
+
+using flacsplit::bench::Benchmark;
+using flacsplit::bench::State;
+
+// the kinds of names that path components are made from
+const std::string NAMES[] = {
+	"Track 01",
+	"Sigur Rós",
+	"( )",
+	"Björk — Jóga",
+	"Mötley Crüe: Dr. Feelgood (Remastered)",
+	"Þórsmörk & Ærøskøbing",
+	"Straße der Œuvres",
+	"Dvořák: Symphony No. 9 in E minor, Op. 95 \"From the New World\"",
+};
+
+//! Time sanitize() on one name after another.
+const Benchmark sanitize("sanitize", [](State &state) {
+	size_t i = 0;
+	uint64_t bytes = 0;
+	while (state.keep_running()) {
+		const std::string &name = NAMES[i++ % std::size(NAMES)];
+		flacsplit::bench::keep(flacsplit::sanitize(name).size());
+		bytes += name.size();
+	}
+	state.set_bytes(bytes);
+	state.set_items(state.iterations());
+});
+
+} // end anon
@@ -1,25 +1,51 @@
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
 
 #include <FLAC++/decoder.h>
 #include <sndfile.h>
 
 #include "decode.hpp"
+#include "deinterleave.hpp"
 #include "errors.hpp"
+#include "iofile.hpp"
 
 namespace {
 
 const unsigned FRAMES_PER_SEC = 75;
 
+//! Where the samples of a plain PCM WAVE file are, and how they're laid out.
+struct Wave_format {
+	int64_t	data_offset;
+	int64_t	data_size;
+	int32_t	sample_rate;
+	int	channels;
+	int	bits_per_sample;
+};
+
+flacsplit::file_format	file_format_of(const char *magic);
 flacsplit::file_format	get_file_format(FILE *);
+template <typename Read, typename Skip>
+bool			parse_wave_header(Read, Skip, Wave_format *);
+std::unique_ptr<flacsplit::Basic_decoder>
+			open_stream(FILE *, flacsplit::file_format,
+			    unsigned read_frames);
 
+//! Reads through an Input_file rather than letting libFLAC use stdio, for
+//! big reads, read ahead, and 64-bit offsets. A stream is seeked in by
+//! decoding up to the sample, so only forward.
 class Flac_decoder :
-    public FLAC::Decoder::File,
+    public FLAC::Decoder::Stream,
     public flacsplit::Basic_decoder {
 public:
 	struct Flac_decode_error : flacsplit::Decode_error {
@@ -32,27 +58,37 @@ public:
 		std::string _msg;
 	};
 
-	//! Note that this takes ownership of the file (or rather, the FLAC
-	//! library takes ownership).
+	//! Note that this takes ownership of the file, once constructed.
+	//! \param input	Reads from \a fp
 	//! \throw Flac_decode_error
-	Flac_decoder(FILE *);
+	Flac_decoder(FILE *fp, std::unique_ptr<flacsplit::Input_file> &&input);
+
+	~Flac_decoder();
 
 	//! \throw Flac_decode_error
 	flacsplit::Frame next_frame(bool allow_short) override;
 
-	void seek(int64_t sample) override {
-		seek_absolute(sample);
-	}
+	//! \throw Flac_decode_error
+	void seek(int64_t sample) override;
 
 	int32_t sample_rate() const override {
-		return get_sample_rate();
+		return _sample_rate;
 	}
 
 	int64_t total_samples() const override {
 		return get_total_samples();
 	}
 
+	size_t max_frame_len() const override {
+		return _max_frame_len;
+	}
+
 protected:
+	FLAC__StreamDecoderReadStatus read_callback(FLAC__byte *, size_t *)
+	    override;
+
+	void metadata_callback(const FLAC__StreamMetadata *) override;
+
 	FLAC__StreamDecoderWriteStatus write_callback(
 	    const FLAC__Frame *, const FLAC__int32 *const *) override;
 
@@ -64,7 +100,8 @@ protected:
 	    override;
 
 	bool eof_callback() override {
-		return feof(_fp);
+		// a stream's end is found by reading it
+		return !_input->stream() && _input->tell() >= _input->size();
 	}
 
 	void error_callback(FLAC__StreamDecoderErrorStatus status) override {
@@ -73,10 +110,17 @@ protected:
 
 private:
 	FILE				*_fp;
+	std::unique_ptr<flacsplit::Input_file>
+					_input;
 	const FLAC__Frame		*_last_frame;
 	std::unique_ptr<const FLAC__int32 *[]>
 					_last_buffer;
+	// how far into _last_frame _last_buffer points, after a seek
+	int64_t				_frame_offset;
 	const char			*_last_status;
+	// from the STREAMINFO; libFLAC only has these from a frame header
+	int32_t				_sample_rate;
+	size_t				_max_frame_len;
 	bool				_frame_retrieved;
 };
 
@@ -93,7 +137,8 @@ public:
 	};
 
 	//! \throw flacsplit::Sndfile_error
-	Wave_decoder(FILE *);
+	//! \throw flacsplit::Unix_error
+	Wave_decoder(FILE *, unsigned read_frames);
 
 	virtual ~Wave_decoder() noexcept {
 		close_quiet(_file);
@@ -119,32 +164,263 @@ public:
 		return _info.frames;
 	}
 
+	size_t max_frame_len() const override {
+		return _samples_len;
+	}
+
 private:
 	static void close_quiet(SNDFILE *file) noexcept;
 
+	// libsndfile's virtual I/O, over _input
+	static sf_count_t vio_length(void *);
+	static sf_count_t vio_seek(sf_count_t, int, void *);
+	static sf_count_t vio_read(void *, sf_count_t, void *);
+	static sf_count_t vio_write(const void *, sf_count_t, void *);
+	static sf_count_t vio_tell(void *);
+
+	// read ahead of libsndfile
+	std::unique_ptr<flacsplit::Input_file>
+					_input;
+
 	std::unique_ptr<int32_t[]>	_samples;
 	std::unique_ptr<int32_t[]>	_transp;
 	std::unique_ptr<int32_t *[]>	_transp_ptrs;
 	SNDFILE		*_file;
 	SF_INFO		_info;
 	sf_count_t	_samples_len;
+	flacsplit::Int_deinterleaver	_deinterleave;
+};
+
+//! Decodes plain PCM WAVE files straight out of a memory mapping; the samples
+//! are converted to planar int32 in a single pass, with no intermediate
+//! copies. Anything fancier is left to Wave_decoder.
+class Mapped_wave_decoder : public flacsplit::Basic_decoder {
+public:
+	using Wave_decode_error = Wave_decoder::Wave_decode_error;
+
+	//! Map the file if it's plain PCM; otherwise return null and leave the
+	//! file where it was. The decoder takes ownership of the file.
+	static std::unique_ptr<Mapped_wave_decoder> open(FILE *,
+	    unsigned read_frames);
+
+	virtual ~Mapped_wave_decoder() noexcept;
+
+	//! \throw Wave_decode_error
+	flacsplit::Frame next_frame(bool allow_short) override;
+
+	//! \throw Wave_decode_error
+	void seek(int64_t sample) override {
+		if (sample > total_samples())
+			throw_traced(Wave_decode_error("seek past end"));
+		_position = sample;
+	}
+
+	int32_t sample_rate() const override {
+		return _format.sample_rate;
+	}
+
+	int64_t total_samples() const override {
+		return _format.data_size / _block_align;
+	}
+
+	size_t max_frame_len() const override {
+		return _block_len * _format.channels;
+	}
+
+private:
+	Mapped_wave_decoder(FILE *, const Wave_format &, const uint8_t *map,
+	    size_t map_len, unsigned read_frames);
+
+	std::unique_ptr<int32_t[]>	_transp;
+	std::unique_ptr<int32_t *[]>	_transp_ptrs;
+	flacsplit::Pcm_deinterleaver	_deinterleave;
+	FILE		*_fp;
+	const uint8_t	*_map;
+	size_t		_map_len;
+	Wave_format	_format;
+	int		_block_align;
+	int64_t		_block_len;
+	int64_t		_position;
+};
+
+//! Decodes plain PCM WAVE files as Mapped_wave_decoder does, but read from a
+//! stream, which can't be mapped; so it can only seek forward.
+class Stream_wave_decoder : public flacsplit::Basic_decoder {
+public:
+	using Wave_decode_error = Wave_decoder::Wave_decode_error;
+
+	//! The decoder takes ownership of the file.
+	//! \param input	Reads from \a fp, at the start of the samples
+	Stream_wave_decoder(FILE *fp,
+	    std::unique_ptr<flacsplit::Input_file> &&input,
+	    const Wave_format &, unsigned read_frames);
+
+	virtual ~Stream_wave_decoder() noexcept;
+
+	//! \throw Wave_decode_error
+	flacsplit::Frame next_frame(bool allow_short) override;
+
+	//! \throw Wave_decode_error
+	void seek(int64_t sample) override;
+
+	int32_t sample_rate() const override {
+		return _format.sample_rate;
+	}
+
+	int64_t total_samples() const override {
+		return _format.data_size / _block_align;
+	}
+
+	size_t max_frame_len() const override {
+		return _block_len * _format.channels;
+	}
+
+private:
+	std::unique_ptr<uint8_t[]>	_block;
+	std::unique_ptr<int32_t[]>	_transp;
+	std::unique_ptr<int32_t *[]>	_transp_ptrs;
+	flacsplit::Pcm_deinterleaver	_deinterleave;
+	FILE		*_fp;
+	std::unique_ptr<flacsplit::Input_file>
+			_input;
+	Wave_format	_format;
+	int		_block_align;
+	int64_t		_block_len;
+	int64_t		_position;
+};
+
+//! Runs another decoder on a thread of its own, into pooled buffers, so that
+//! decoding overlaps with whatever is done with the frames, and they can be
+//! pinned. A seek into what's been decoded already just skips ahead; any
+//! other seek restarts the thread.
+class Decode_ahead : public flacsplit::Basic_decoder {
+public:
+	struct Decode_ahead_error : flacsplit::Decode_error {
+		Decode_ahead_error(const char *msg) : msg(msg) {}
+
+		const char *what() const noexcept override {
+			return msg.c_str();
+		}
+
+		std::string msg;
+	};
+
+	//! \param frames	How many frames may be decoded ahead, counting
+	//!	pinned ones
+	Decode_ahead(std::unique_ptr<flacsplit::Basic_decoder> &&decoder,
+	    unsigned frames);
+
+	virtual ~Decode_ahead() noexcept {
+		stop();
+	}
+
+	//! \throw Decode_ahead_error
+	//! \throw flacsplit::Decode_error	Whatever the decoder threw
+	flacsplit::Frame next_frame(bool allow_short) override;
+
+	flacsplit::Frame_ref pin() const override {
+		return _current;
+	}
+
+	//! \throw flacsplit::Decode_error	Whatever the decoder threw
+	void seek(int64_t sample) override;
+
+	int32_t sample_rate() const override {
+		return _sample_rate;
+	}
+
+	int64_t total_samples() const override {
+		return _total_samples;
+	}
+
+	size_t max_frame_len() const override {
+		return _max_frame_len;
+	}
+
+private:
+	//! A decoded frame, or where decoding ended
+	struct Item {
+		flacsplit::Frame_ref	ref;
+		// without data, which is in ref
+		flacsplit::Frame	frame;
+		int64_t			first;
+		// why decoding ended, if it failed
+		std::exception_ptr	error;
+		bool			end;
+	};
+
+	void run(std::stop_token) noexcept;
+	void start();
+	void stop() noexcept;
+	void push(Item &&);
+	void pop();
+	bool skip_to(int64_t sample);
+
+	std::unique_ptr<flacsplit::Basic_decoder>
+				_decoder;
+	flacsplit::Frame_pool	_pool;
+	// a ring of decoded frames, in order; it can't fill up, since it has
+	// room for every buffer and the end
+	std::vector<Item>	_queue;
+	size_t			_head;
+	size_t			_count;
+	std::mutex		_mutex;
+	std::condition_variable	_cond;
+	// whether the head of the queue was the last frame returned; it stays
+	// until the next, so a seek may go back into it
+	bool			_returned;
+	// the last frame returned
+	flacsplit::Frame_ref	_current;
+	std::vector<const int32_t *>
+				_data;
+	// where the next frame returned starts
+	int64_t			_position;
+	// where the thread's next frame starts; the thread's while it runs
+	int64_t			_next;
+	// read once, since _decoder is the thread's
+	int32_t			_sample_rate;
+	int64_t			_total_samples;
+	size_t			_max_frame_len;
+	// decoded before a stop while waiting for a buffer, and pushed
+	// first on restart; its data are the decoder's until then
+	flacsplit::Frame	_pending;
+	bool			_has_pending;
+	std::jthread		_thread;
 };
 
-Flac_decoder::Flac_decoder(FILE *fp) :
-	FLAC::Decoder::File(),
+Flac_decoder::Flac_decoder(FILE *fp,
+    std::unique_ptr<flacsplit::Input_file> &&input) :
+	FLAC::Decoder::Stream(),
 	Basic_decoder(),
 	_fp(fp),
+	_input(std::move(input)),
 	_last_frame(nullptr),
 	_last_buffer(),
+	_frame_offset(0),
 	_last_status(nullptr),
+	_sample_rate(0),
+	_max_frame_len(0),
 	_frame_retrieved(false)
 {
 	FLAC__StreamDecoderInitStatus status;
-	if ((status = init(fp)) != FLAC__STREAM_DECODER_INIT_STATUS_OK)
+	if ((status = init()) != FLAC__STREAM_DECODER_INIT_STATUS_OK)
 		throw_traced(Flac_decode_error(
 		    FLAC__StreamDecoderInitStatusString[status]
 		));
-	seek(0);
+	// enough for the stream info; the first frame is decoded by the first
+	// next_frame(), without seeking there
+	if (!process_until_end_of_metadata())
+		throw_traced(Flac_decode_error(get_state().as_cstring()));
+	// libFLAC insists on it, but every offset depends on the rate
+	if (!_sample_rate)
+		throw_traced(Flac_decode_error("no sample rate in STREAMINFO"));
+}
+
+Flac_decoder::~Flac_decoder() {
+	finish();
+	// any read ahead is finished first
+	_input.reset();
+	fclose(_fp);
 }
 
 flacsplit::Frame
@@ -163,12 +439,51 @@ Flac_decoder::next_frame(bool) {
 	frame.data = _last_buffer.get();
 	frame.bits_per_sample = _last_frame->header.bits_per_sample;
 	frame.channels = _last_frame->header.channels;
-	frame.samples = _last_frame->header.blocksize;
+	frame.samples = _last_frame->header.blocksize - _frame_offset;
 	frame.rate = _last_frame->header.sample_rate;
 	_frame_retrieved = true;
 	return frame;
 }
 
+void
+Flac_decoder::seek(int64_t sample) {
+	if (!_input->stream()) {
+		seek_absolute(sample);
+		return;
+	}
+
+	for (;;) {
+		// the last frame counts even if it was returned already; the
+		// caller may only have used part of it
+		if (_last_frame) {
+			const FLAC__FrameHeader &header = _last_frame->header;
+			int64_t first = header.number.sample_number;
+			if (sample < first)
+				throw_traced(Flac_decode_error(
+				    "can't seek backward in a stream"
+				));
+			if (sample < first + header.blocksize) {
+				int64_t offset = sample - first;
+				for (unsigned c = 0; c < header.channels; c++)
+					_last_buffer[c] += offset -
+					    _frame_offset;
+				_frame_offset = offset;
+				_frame_retrieved = false;
+				return;
+			}
+		}
+
+		if (get_state() == FLAC__STREAM_DECODER_END_OF_STREAM)
+			throw_traced(Flac_decode_error("seek past end"));
+		if (!process_single())
+			throw_traced(Flac_decode_error(
+			    get_state().as_cstring()
+			));
+		if (_last_status)
+			throw_traced(Flac_decode_error(_last_status));
+	}
+}
+
 FLAC__StreamDecoderWriteStatus
 Flac_decoder::write_callback(const FLAC__Frame *frame,
     const FLAC__int32 *const *buffer) {
@@ -186,57 +501,87 @@ Flac_decoder::write_callback(const FLAC__Frame *frame,
 	_last_frame = frame;
 	std::copy(buffer, buffer + frame->header.channels,
 	    _last_buffer.get());
+	_frame_offset = 0;
 	_last_status = nullptr;
 	_frame_retrieved = false;
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
+void
+Flac_decoder::metadata_callback(const FLAC__StreamMetadata *metadata) {
+	if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+		const FLAC__StreamMetadata_StreamInfo &info =
+		    metadata->data.stream_info;
+		_sample_rate = info.sample_rate;
+		_max_frame_len = static_cast<size_t>(info.max_blocksize) *
+		    info.channels;
+	}
+}
+
+FLAC__StreamDecoderReadStatus
+Flac_decoder::read_callback(FLAC__byte *buffer, size_t *bytes) {
+	ssize_t n = _input->read(buffer, *bytes);
+	if (n < 0) {
+		*bytes = 0;
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	}
+	*bytes = n;
+	return n ? FLAC__STREAM_DECODER_READ_STATUS_CONTINUE :
+	    FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+}
+
 FLAC__StreamDecoderSeekStatus
 Flac_decoder::seek_callback(FLAC__uint64 absolute_byte_offset) {
-	long off = absolute_byte_offset;
-	if (static_cast<FLAC__uint64>(off) != absolute_byte_offset)
-		flacsplit::throw_traced(std::runtime_error("bad offset"));
+	off_t off = absolute_byte_offset;
+	if (off < 0 || static_cast<FLAC__uint64>(off) != absolute_byte_offset)
+		return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
 
-	return fseek(_fp, off, SEEK_SET) ?
-	    FLAC__STREAM_DECODER_SEEK_STATUS_ERROR :
-	    FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+	return _input->seek(off) ?
+	    FLAC__STREAM_DECODER_SEEK_STATUS_OK :
+	    FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
 }
 
 FLAC__StreamDecoderTellStatus
 Flac_decoder::tell_callback(FLAC__uint64 *absolute_byte_offset) {
-	long off = ftell(_fp);
-	if (off < 0)
-		return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
-	*absolute_byte_offset = off;
+	*absolute_byte_offset = _input->tell();
 	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
 
 FLAC__StreamDecoderLengthStatus
 Flac_decoder::length_callback(FLAC__uint64 *stream_length) {
-	struct stat st;
-	if (fstat(fileno(_fp), &st))
-		return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
-	*stream_length = st.st_size;
+	// seek_absolute() needs it, so a stream is seeked in otherwise
+	if (_input->stream())
+		return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+	*stream_length = _input->size();
 	return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
 }
 
-Wave_decoder::Wave_decoder(FILE *fp) :
+Wave_decoder::Wave_decoder(FILE *fp, unsigned read_frames) :
 	Basic_decoder(),
+	_input(new flacsplit::Input_file(fileno(fp))),
 	_samples(),
 	_transp()
 {
-	_file = sf_open_fd(fileno(fp), SFM_READ, &_info, false);
+	// Input_file reads from the start, wherever stdio left fp
+	SF_VIRTUAL_IO vio;
+	vio.get_filelen = vio_length;
+	vio.seek = vio_seek;
+	vio.read = vio_read;
+	vio.write = vio_write;
+	vio.tell = vio_tell;
+	_file = sf_open_virtual(&vio, SFM_READ, &_info, _input.get());
 	if (!_file)
 		throw_traced(flacsplit::Sndfile_error(
-		    "sf_open_fd failed", sf_error(nullptr)
+		    "sf_open_virtual failed", sf_error(nullptr)
 		));
 
 	try {
-		_samples_len = _info.channels * _info.samplerate /
-		    FRAMES_PER_SEC;
+		_samples_len = _info.channels * (_info.samplerate *
+		    static_cast<sf_count_t>(read_frames) / FRAMES_PER_SEC);
 		_samples.reset(new int32_t[_samples_len]);
 		_transp.reset(new int32_t[_samples_len]);
 		_transp_ptrs.reset(new int32_t *[_info.channels]);
+		_deinterleave = flacsplit::int_deinterleaver(_info.channels);
 	} catch (...) {
 		close_quiet(_file);
 		throw;
@@ -253,15 +598,47 @@ Wave_decoder::close_quiet(SNDFILE *file) noexcept {
 		}
 }
 
+sf_count_t
+Wave_decoder::vio_length(void *input) {
+	return static_cast<flacsplit::Input_file *>(input)->size();
+}
+
+sf_count_t
+Wave_decoder::vio_seek(sf_count_t offset, int whence, void *input) {
+	auto *in = static_cast<flacsplit::Input_file *>(input);
+	switch (whence) {
+	case SEEK_CUR:	offset += in->tell(); break;
+	case SEEK_END:	offset += in->size(); break;
+	}
+	if (!in->seek(offset))
+		return -1;
+	return offset;
+}
+
+sf_count_t
+Wave_decoder::vio_read(void *buf, sf_count_t count, void *input) {
+	ssize_t n = static_cast<flacsplit::Input_file *>(input)->read(buf,
+	    count);
+	// libsndfile takes a short read as the end of the file
+	return std::max<ssize_t>(n, 0);
+}
+
+sf_count_t
+Wave_decoder::vio_write(const void *, sf_count_t, void *) {
+	return 0;
+}
+
+sf_count_t
+Wave_decoder::vio_tell(void *input) {
+	return static_cast<flacsplit::Input_file *>(input)->tell();
+}
+
 flacsplit::Frame
 Wave_decoder::next_frame(bool allow_short) {
 	sf_count_t samples;
 	samples = sf_read_int(_file, _samples.get(), _samples_len);
-	if (!allow_short && samples < _samples_len) {
-		// This may only occur on the final track if this is not an
-		// exact number of frames. Perhaps because the data is not from
-		// a CD.
-		std::cerr << "expected " << _samples_len << " but got " << samples << '\n';
+	if (!allow_short && !samples) {
+		// The cue sheet runs past the end of the data.
 		throw_traced(flacsplit::Sndfile_error(
 		    "sf_read error", sf_error(_file)
 		));
@@ -291,15 +668,8 @@ Wave_decoder::next_frame(bool allow_short) {
 
 	// transpose _samples => _transp
 	// Also scale down values when not 32bit.
-	size_t i = 0;
-	for (int sample = 0; sample < frame.samples; sample++) {
-		int j = sample;
-		for (int channel = 0; channel < frame.channels; channel++) {
-			_transp.get()[j] = _samples.get()[i] >> shamt;
-			i++;
-			j += frame.samples;
-		}
-	}
+	_deinterleave(_samples.get(), _transp.get(), frame.channels,
+	    frame.samples, shamt);
 
 	// make 2d array to return
 	_transp_ptrs.get()[0] = _transp.get();
@@ -310,40 +680,578 @@ Wave_decoder::next_frame(bool allow_short) {
 	return frame;
 }
 
+std::unique_ptr<Mapped_wave_decoder>
+Mapped_wave_decoder::open(FILE *fp, unsigned read_frames) {
+	Wave_format format;
+	bool plain = parse_wave_header(
+	    [fp](void *buf, size_t len) {
+		return fread(buf, len, 1, fp) == 1;
+	    },
+	    [fp](off_t len) {
+		return !fseek(fp, len, SEEK_CUR);
+	    },
+	    &format);
+	if (fseek(fp, 0, SEEK_SET))
+		throw_traced(flacsplit::Unix_error("rewinding WAVE file"));
+	if (!plain)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) || !st.st_size)
+		return nullptr;
+
+	// a header written before the length was known may overstate it
+	format.data_size = std::min(format.data_size,
+	    st.st_size - format.data_offset);
+
+	size_t map_len = st.st_size;
+	void *map = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE,
+	    fileno(fp), 0);
+	if (map == MAP_FAILED)
+		return nullptr;
+	madvise(map, map_len, MADV_SEQUENTIAL);
+
+	try {
+		return std::unique_ptr<Mapped_wave_decoder>(
+		    new Mapped_wave_decoder(fp, format,
+		    static_cast<const uint8_t *>(map), map_len,
+		    read_frames));
+	} catch (...) {
+		munmap(map, map_len);
+		throw;
+	}
+}
+
+Mapped_wave_decoder::Mapped_wave_decoder(FILE *fp, const Wave_format &format,
+    const uint8_t *map, size_t map_len, unsigned read_frames) :
+	Basic_decoder(),
+	_transp(),
+	_transp_ptrs(),
+	_deinterleave(flacsplit::pcm_deinterleaver(format.bits_per_sample,
+	    format.channels)),
+	_fp(fp),
+	_map(map),
+	_map_len(map_len),
+	_format(format),
+	_block_align(format.channels * (format.bits_per_sample / 8)),
+	_block_len(format.sample_rate * static_cast<int64_t>(read_frames) /
+	    FRAMES_PER_SEC),
+	_position(0)
+{
+	_transp.reset(new int32_t[_block_len * format.channels]);
+	_transp_ptrs.reset(new int32_t *[format.channels]);
+}
+
+Mapped_wave_decoder::~Mapped_wave_decoder() noexcept {
+	munmap(const_cast<uint8_t *>(_map), _map_len);
+	fclose(_fp);
+}
+
+flacsplit::Frame
+Mapped_wave_decoder::next_frame(bool allow_short) {
+	int64_t samples = std::min(_block_len, total_samples() - _position);
+	if (!allow_short && !samples)
+		throw_traced(Wave_decode_error("unexpected end of data"));
+
+	const uint8_t *in = _map + _format.data_offset +
+	    _position * _block_align;
+	_deinterleave(in, _transp.get(), _format.channels, samples);
+	_position += samples;
+
+	// make 2d array to return
+	_transp_ptrs.get()[0] = _transp.get();
+	for (int channel = 1; channel < _format.channels; channel++)
+		_transp_ptrs.get()[channel] = _transp_ptrs.get()[channel-1] +
+		    samples;
+
+	flacsplit::Frame frame;
+	frame.data = _transp_ptrs.get();
+	frame.bits_per_sample = _format.bits_per_sample;
+	frame.channels = _format.channels;
+	frame.samples = samples;
+	frame.rate = _format.sample_rate;
+	return frame;
+}
+
+Stream_wave_decoder::Stream_wave_decoder(FILE *fp,
+    std::unique_ptr<flacsplit::Input_file> &&input, const Wave_format &format,
+    unsigned read_frames) :
+	Basic_decoder(),
+	_block(),
+	_transp(),
+	_transp_ptrs(),
+	_deinterleave(flacsplit::pcm_deinterleaver(format.bits_per_sample,
+	    format.channels)),
+	_fp(fp),
+	_input(std::move(input)),
+	_format(format),
+	_block_align(format.channels * (format.bits_per_sample / 8)),
+	_block_len(format.sample_rate * static_cast<int64_t>(read_frames) /
+	    FRAMES_PER_SEC),
+	_position(0)
+{
+	_block.reset(new uint8_t[_block_len * _block_align]);
+	_transp.reset(new int32_t[_block_len * format.channels]);
+	_transp_ptrs.reset(new int32_t *[format.channels]);
+}
+
+Stream_wave_decoder::~Stream_wave_decoder() noexcept {
+	// any read ahead is finished first
+	_input.reset();
+	fclose(_fp);
+}
+
+flacsplit::Frame
+Stream_wave_decoder::next_frame(bool allow_short) {
+	int64_t samples = std::min(_block_len, total_samples() - _position);
+	ssize_t n = _input->read(_block.get(), samples * _block_align);
+	if (n < 0)
+		throw_traced(Wave_decode_error("read error"));
+	// the header may overstate the length, which isn't known up front
+	samples = n / _block_align;
+	if (!allow_short && !samples)
+		throw_traced(Wave_decode_error("unexpected end of data"));
+
+	_deinterleave(_block.get(), _transp.get(), _format.channels, samples);
+	_position += samples;
+
+	// make 2d array to return
+	_transp_ptrs.get()[0] = _transp.get();
+	for (int channel = 1; channel < _format.channels; channel++)
+		_transp_ptrs.get()[channel] = _transp_ptrs.get()[channel-1] +
+		    samples;
+
+	flacsplit::Frame frame;
+	frame.data = _transp_ptrs.get();
+	frame.bits_per_sample = _format.bits_per_sample;
+	frame.channels = _format.channels;
+	frame.samples = samples;
+	frame.rate = _format.sample_rate;
+	return frame;
+}
+
+void
+Stream_wave_decoder::seek(int64_t sample) {
+	if (sample < _position)
+		throw_traced(Wave_decode_error(
+		    "can't seek backward in a stream"));
+	if (sample > total_samples())
+		throw_traced(Wave_decode_error("seek past end"));
+	if (!_input->seek(_format.data_offset + sample * _block_align))
+		throw_traced(Wave_decode_error("read error"));
+	_position = sample;
+}
+
+Decode_ahead::Decode_ahead(std::unique_ptr<flacsplit::Basic_decoder> &&decoder,
+    unsigned frames) :
+	Basic_decoder(),
+	_decoder(std::move(decoder)),
+	_pool(frames, _decoder->max_frame_len()),
+	_queue(frames + 1),
+	_head(0),
+	_count(0),
+	_mutex(),
+	_cond(),
+	_returned(false),
+	_current(),
+	_data(),
+	_position(0),
+	_next(0),
+	_sample_rate(_decoder->sample_rate()),
+	_total_samples(_decoder->total_samples()),
+	_max_frame_len(_decoder->max_frame_len()),
+	_pending(),
+	_has_pending(false),
+	_thread()
+{
+	start();
+}
+
+flacsplit::Frame
+Decode_ahead::next_frame(bool allow_short) {
+	// the last frame may hold the only free buffer
+	_current = flacsplit::Frame_ref();
+
+	flacsplit::Frame frame;
+	int64_t first;
+	{
+		std::unique_lock lock(_mutex);
+		if (_returned) {
+			pop();
+			_returned = false;
+		}
+		_cond.wait(lock, [this]() { return _count; });
+		Item &item = _queue[_head];
+		if (item.end) {
+			// left in place, so every call after this ends, too
+			if (item.error)
+				std::rethrow_exception(item.error);
+			if (!allow_short)
+				throw_traced(Decode_ahead_error(
+				    "unexpected end of data"));
+			frame = item.frame;
+			frame.data = _data.data();
+			frame.samples = 0;
+			return frame;
+		}
+		_current = item.ref;
+		frame = item.frame;
+		first = item.first;
+		_returned = true;
+	}
+
+	// a seek may have skipped into the frame
+	int64_t skip = _position - first;
+	_data.resize(frame.channels);
+	for (int c = 0; c < frame.channels; c++)
+		_data[c] = _current.samples() + c * frame.samples + skip;
+	frame.data = _data.data();
+	frame.samples -= skip;
+	_position += frame.samples;
+	return frame;
+}
+
+void
+Decode_ahead::seek(int64_t sample) {
+	// skipping ahead needn't stop the thread; what it's decoding now may
+	// be what's wanted
+	if (skip_to(sample))
+		return;
+	stop();
+	if (skip_to(sample)) {
+		if (!_queue[(_head + _count - 1) % _queue.size()].end)
+			start();
+		return;
+	}
+
+	while (_count)
+		pop();
+	_returned = false;
+	_has_pending = false;
+	try {
+		_decoder->seek(sample);
+	} catch (...) {
+		// the next frame fails the same way
+		push(Item{.ref={}, .frame={}, .first=sample,
+		    .error=std::current_exception(), .end=true});
+		throw;
+	}
+	_position = _next = sample;
+	start();
+}
+
+void
+Decode_ahead::run(std::stop_token stop) noexcept {
+	Item end{.ref={}, .frame={}, .first=_next, .error=nullptr, .end=true};
+	try {
+		// libFLAC gives the last frame again, past the end
+		while (_next < _total_samples && !stop.stop_requested()) {
+			flacsplit::Frame frame;
+			if (_has_pending) {
+				frame = _pending;
+				_has_pending = false;
+			} else {
+				frame = _decoder->next_frame(true);
+				if (!frame.samples)
+					break;
+			}
+
+			flacsplit::Frame_ref ref = _pool.acquire(
+			    frame.samples * frame.channels, stop);
+			if (!ref) {
+				// _next stays at it, so a seek may land in it
+				_pending = frame;
+				_has_pending = true;
+				return;
+			}
+			for (int c = 0; c < frame.channels; c++)
+				std::copy(frame.data[c],
+				    frame.data[c] + frame.samples,
+				    ref.samples() + c * frame.samples);
+			frame.data = nullptr;
+
+			push(Item{.ref=std::move(ref), .frame=frame,
+			    .first=_next, .error=nullptr, .end=false});
+			_next += frame.samples;
+		}
+		if (stop.stop_requested())
+			return;
+	} catch (...) {
+		end.error = std::current_exception();
+	}
+	end.first = _next;
+	push(std::move(end));
+}
+
+void
+Decode_ahead::start() {
+	_thread = std::jthread([this](std::stop_token stop) { run(stop); });
+}
+
+void
+Decode_ahead::stop() noexcept {
+	if (_thread.joinable()) {
+		_thread.request_stop();
+		_thread.join();
+	}
+}
+
+void
+Decode_ahead::push(Item &&item) {
+	{
+		std::lock_guard lock(_mutex);
+		_queue[(_head + _count) % _queue.size()] = std::move(item);
+		_count++;
+	}
+	_cond.notify_all();
+}
+
+//! With _mutex held, or the thread stopped.
+void
+Decode_ahead::pop() {
+	// the buffer goes back to the pool, unless it's pinned
+	_queue[_head] = Item();
+	_head = (_head + 1) % _queue.size();
+	_count--;
+}
+
+//! Skip through the decoded frames to \a sample, if it's among them or in
+//! the last frame returned.
+bool
+Decode_ahead::skip_to(int64_t sample) {
+	std::lock_guard lock(_mutex);
+	while (_count) {
+		const Item &item = _queue[_head];
+		if (item.end || sample < item.first)
+			return false;
+		if (sample < item.first + item.frame.samples) {
+			// from here, even if it was returned already
+			_position = sample;
+			_returned = false;
+			return true;
+		}
+		pop();
+		_returned = false;
+	}
+	return false;
+}
+
+//! The format of a file from its first 12 bytes.
 flacsplit::file_format
-get_file_format(FILE *fp) {
+file_format_of(const char *magic) {
 	const char *const RIFF = "RIFF";
 	const char *const WAVE = "WAVE";
 	const char *const FLAC = "fLaC";
 
+	if (std::equal(magic, magic+4, RIFF) &&
+	    std::equal(magic+8, magic+12, WAVE))
+		return flacsplit::file_format::WAVE;
+	if (std::equal(magic, magic+4, FLAC))
+		return flacsplit::file_format::FLAC;
+	return flacsplit::file_format::UNKNOWN;
+}
+
+flacsplit::file_format
+get_file_format(FILE *fp) {
 	char buf[12];
 
 	if (!fread(buf, sizeof(buf), 1, fp))
 		return flacsplit::file_format::UNKNOWN;
 	fseek(fp, -sizeof(buf), SEEK_CUR);
+	return file_format_of(buf);
+}
 
-	if (std::equal(buf, buf+4, RIFF) && std::equal(buf+8, buf+12, WAVE))
-		return flacsplit::file_format::WAVE;
-	if (std::equal(buf, buf+4, FLAC))
-		return flacsplit::file_format::FLAC;
-	return flacsplit::file_format::UNKNOWN;
+// Only plain integer PCM with whole-byte samples is accepted; that covers
+// everything a CD ripper writes. The header is read with read(buf, len),
+// which reads all of it or fails, and skip(len).
+template <typename Read, typename Skip>
+bool
+parse_wave_header(Read read, Skip skip, Wave_format *format) {
+	auto le16 = [](const uint8_t *p) -> uint32_t {
+		return p[0] | p[1] << 8;
+	};
+	auto le32 = [](const uint8_t *p) -> uint32_t {
+		return p[0] | p[1] << 8 | p[2] << 16 |
+		    static_cast<uint32_t>(p[3]) << 24;
+	};
+	// KSDATAFORMAT_SUBTYPE_PCM, after the format tag
+	const uint8_t PCM_GUID_TAIL[] = {
+		0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+		0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+	};
+	const unsigned WAVE_FORMAT_PCM = 0x0001;
+	const unsigned WAVE_FORMAT_EXTENSIBLE = 0xfffe;
+
+	uint8_t buf[40];
+	if (!read(buf, 12))
+		return false;
+	int64_t offset = 12;
+
+	bool have_fmt = false;
+	for (;;) {
+		if (!read(buf, 8))
+			return false;
+		offset += 8;
+		uint32_t size = le32(buf + 4);
+
+		if (std::equal(buf, buf+4, "data")) {
+			if (!have_fmt)
+				return false;
+			format->data_offset = offset;
+			format->data_size = size;
+			return true;
+		}
+
+		if (std::equal(buf, buf+4, "fmt ")) {
+			if (size < 16 || size > sizeof(buf) ||
+			    !read(buf, size))
+				return false;
+
+			unsigned tag = le16(buf);
+			unsigned block_align = le16(buf + 12);
+			format->channels = le16(buf + 2);
+			format->sample_rate = le32(buf + 4);
+			format->bits_per_sample = le16(buf + 14);
+
+			if (tag == WAVE_FORMAT_EXTENSIBLE) {
+				// the valid bits must fill the container
+				if (size < 40 ||
+				    le16(buf + 18) != static_cast<unsigned>(
+				    format->bits_per_sample) ||
+				    le16(buf + 24) != WAVE_FORMAT_PCM ||
+				    !std::equal(buf + 26, buf + 40,
+				    PCM_GUID_TAIL))
+					return false;
+			} else if (tag != WAVE_FORMAT_PCM)
+				return false;
+
+			switch (format->bits_per_sample) {
+			case 8: case 16: case 24: case 32: break;
+			default: return false;
+			}
+			if (!format->channels || !format->sample_rate ||
+			    block_align != format->channels *
+			    static_cast<unsigned>(format->bits_per_sample / 8))
+				return false;
+			have_fmt = true;
+		} else if (!skip(size))
+			return false;
+
+		// chunks are padded to an even length
+		offset += size;
+		if (size % 2) {
+			if (!skip(1))
+				return false;
+			offset++;
+		}
+	}
+}
+
+//! A decoder for \a fp, which isn't a regular file; what stdio read of it
+//! couldn't be put back, so it's only read through an Input_file. That
+//! rules out anything but plain PCM WAVE and FLAC.
+std::unique_ptr<flacsplit::Basic_decoder>
+open_stream(FILE *fp, flacsplit::file_format format, unsigned read_frames) {
+	auto input = std::make_unique<flacsplit::Input_file>(fileno(fp));
+	if (format == flacsplit::file_format::UNKNOWN) {
+		char magic[12];
+		if (input->read(magic, sizeof(magic)) == sizeof(magic))
+			format = file_format_of(magic);
+		// still in the first buffer
+		input->seek(0);
+	}
+
+	switch (format) {
+	case flacsplit::file_format::UNKNOWN:
+		break;
+	case flacsplit::file_format::WAVE: {
+		Wave_format wave;
+		if (!parse_wave_header(
+		    [&](void *buf, size_t len) {
+			return input->read(buf, len) ==
+			    static_cast<ssize_t>(len);
+		    },
+		    [&](off_t len) {
+			return input->seek(input->tell() + len);
+		    },
+		    &wave))
+			throw_traced(Wave_decoder::Wave_decode_error(
+			    "only plain PCM WAVE can be read from a stream"
+			));
+		return std::unique_ptr<flacsplit::Basic_decoder>(
+		    new Stream_wave_decoder(fp, std::move(input), wave,
+		    read_frames));
+	}
+	case flacsplit::file_format::FLAC:
+		return std::unique_ptr<flacsplit::Basic_decoder>(
+		    new Flac_decoder(fp, std::move(input)));
+	}
+	throw_traced(flacsplit::Bad_format());
 }
 
 } // end anon
 
-flacsplit::Decoder::Decoder(FILE *fp, file_format format) :
+flacsplit::Decoder::Decoder(FILE *fp, file_format format,
+    unsigned read_frames, unsigned ahead) :
 	Basic_decoder(),
-	_decoder()
+	_decoder(),
+	_rest(),
+	_rest_data(),
+	_frame_data(),
+	_position(0)
 {
-	if (format == file_format::UNKNOWN)
-		format = get_file_format(fp);
-	switch (format) {
-	case file_format::UNKNOWN:
-		throw throw_traced(Bad_format());
-	case file_format::WAVE:
-		_decoder.reset(new Wave_decoder(fp));
-		break;
-	case file_format::FLAC:
-		_decoder.reset(new Flac_decoder(fp));
+	struct stat st;
+	if (!fstat(fileno(fp), &st) && !S_ISREG(st.st_mode))
+		_decoder = open_stream(fp, format, read_frames);
+	else {
+		if (format == file_format::UNKNOWN)
+			format = get_file_format(fp);
+		switch (format) {
+		case file_format::UNKNOWN:
+			throw throw_traced(Bad_format());
+		case file_format::WAVE:
+			if (!(_decoder = Mapped_wave_decoder::open(fp,
+			    read_frames)))
+				_decoder.reset(new Wave_decoder(fp,
+				    read_frames));
+			break;
+		case file_format::FLAC:
+			_decoder.reset(new Flac_decoder(fp,
+			    std::make_unique<Input_file>(fileno(fp))));
+		}
 	}
+
+	if (ahead)
+		_decoder.reset(new Decode_ahead(std::move(_decoder), ahead));
+}
+
+flacsplit::Frame
+flacsplit::Decoder::next_frame(bool allow_short, int64_t max_samples) {
+	Frame frame;
+	if (_rest.samples) {
+		// copy the pointers, since _rest_data may be overwritten below
+		std::copy(_rest_data.begin(), _rest_data.end(),
+		    _frame_data.begin());
+		frame = _rest;
+		frame.data = _frame_data.data();
+		_rest.samples = 0;
+	} else
+		frame = _decoder->next_frame(allow_short);
+
+	if (frame.samples > max_samples) {
+		if (_rest_data.empty()) {
+			// the number of channels should be constant
+			_rest_data.resize(frame.channels);
+			_frame_data.resize(frame.channels);
+		}
+		for (int c = 0; c < frame.channels; c++)
+			_rest_data[c] = frame.data[c] + max_samples;
+		_rest = frame;
+		_rest.data = _rest_data.data();
+		_rest.samples = frame.samples - max_samples;
+		frame.samples = max_samples;
+	}
+
+	_position += frame.samples;
+	return frame;
 }
@@ -2,9 +2,12 @@
 #define DECODE_HPP
 
 #include <cstdio>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include "errors.hpp"
+#include "frame_pool.hpp"
 #include "transcode.hpp"
 
 namespace flacsplit {
@@ -18,44 +21,92 @@ public:
 
 	virtual ~Basic_decoder() noexcept {}
 
+	//! The last frame of the stream may be short. Running out of samples
+	//! altogether is an error unless \a allow_short is set, in which case
+	//! an empty frame is returned.
 	//! \throw DecodeError
 	virtual Frame next_frame(bool allow_short) = 0;
 
+	//! A reference that keeps the samples of the last frame returned from
+	//! being overwritten, so they can be used after the next call; empty
+	//! if the decoder doesn't pool its buffers.
+	virtual Frame_ref pin() const {
+		return Frame_ref();
+	}
+
 	//! \throw DecodeError
 	virtual void seek(int64_t sample) = 0;
 
 	virtual int32_t sample_rate() const = 0;
 
 	virtual int64_t total_samples() const = 0;
+
+	//! The most samples, over all channels, that a frame may hold, so
+	//! buffers can be sized up front.
+	virtual size_t max_frame_len() const = 0;
 };
 
+//! The sample that CD frame \a frame (of 1/75 s) starts at.
+//! \throw std::runtime_error	If it doesn't start on one
+inline int64_t
+frame_sample(int32_t sample_rate, int64_t frame) {
+	// sample rates aren't always divisible by 3*5*5 = 75, e.g.
+	// 32 kHz, which MP3 supports
+	int64_t numer = sample_rate * frame;
+	int64_t sample = numer / 75;
+	if (sample * 75 != numer)
+		throw_traced(std::runtime_error(
+		    "frame number doesn't map to a sample number"
+		));
+	return sample;
+}
+
 class Decoder : public Basic_decoder {
 public:
+	//! Anything but a regular file, such as a pipe, is decoded as a
+	//! stream: only plain PCM WAVE or FLAC, and only seeking forward.
+	//! \param read_frames	How much of a WAVE file to read at a time,
+	//!	in CD frames (1/75 s); FLAC is read a FLAC frame at a time
+	//! \param ahead	If nonzero, decode on a thread of its own, up to
+	//!	this many frames ahead (counting pinned ones) into pooled
+	//!	buffers, which pin() refers to
 	//! \throw Bad_format
 	//! \throw Sndfile_error
-	Decoder(FILE *, file_format=file_format::UNKNOWN);
+	//! \throw Unix_error
+	Decoder(FILE *, file_format=file_format::UNKNOWN,
+	    unsigned read_frames=1, unsigned ahead=0);
 
 	//! \throw DecodeError
 	Frame next_frame(bool allow_short) override {
-		return _decoder->next_frame(allow_short);
+		return next_frame(allow_short,
+		    std::numeric_limits<int64_t>::max());
+	}
+
+	//! Like next_frame(), but return no more than \a max_samples. What is
+	//! left of the frame is returned by the next call.
+	//! \throw DecodeError
+	Frame next_frame(bool allow_short, int64_t max_samples);
+
+	//! A part of a frame returned by next_frame() is pinned along with
+	//! the rest of it.
+	Frame_ref pin() const override {
+		return _decoder->pin();
 	}
 
+	//! Seeking to where the last frame left off is free, so splitting
+	//! contiguous tracks decodes the stream just once.
 	//! \throw DecodeError
 	void seek(int64_t sample) override {
+		if (sample == _position)
+			return;
 		_decoder->seek(sample);
+		_rest.samples = 0;
+		_position = sample;
 	}
 
 	//! \throw DecodeError
 	void seek_frame(int64_t frame) {
-		// sample rates aren't always divisible by 3*5*5 = 75, e.g.
-		// 32 kHz, which MP3 supports
-		int64_t numer = _decoder->sample_rate() * frame;
-		int64_t sample = numer / 75;
-		if (sample * 75 != numer)
-			throw_traced(std::runtime_error(
-			    "frame number doesn't map to a sample number"
-			));
-		seek(sample);
+		seek(frame_sample(_decoder->sample_rate(), frame));
 	}
 
 	int32_t sample_rate() const override {
@@ -66,8 +117,18 @@ public:
 		return _decoder->total_samples();
 	}
 
+	size_t max_frame_len() const override {
+		return _decoder->max_frame_len();
+	}
+
 private:
 	std::unique_ptr<Basic_decoder>	_decoder;
+
+	// the unreturned part of the last frame; points into _rest_data
+	Frame				_rest;
+	std::vector<const int32_t *>	_rest_data;
+	std::vector<const int32_t *>	_frame_data;
+	int64_t				_position;
 };
 
 }
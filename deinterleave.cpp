@@ -0,0 +1,328 @@
+#include <cstdint>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#	define FLACSPLIT_X86 1
+#	include <immintrin.h>
+#endif
+
+#include "deinterleave.hpp"
+
+namespace {
+
+//! Read a little-endian sample of \a Bytes bytes.
+template <int Bytes>
+inline int32_t
+read_sample(const uint8_t *p) {
+	if constexpr (Bytes == 1)
+		// 8-bit WAVE is unsigned
+		return static_cast<int32_t>(p[0]) - 0x80;
+	else if constexpr (Bytes == 2)
+		return static_cast<int16_t>(p[0] | p[1] << 8);
+	else if constexpr (Bytes == 3)
+		return static_cast<int32_t>(
+		    static_cast<uint32_t>(p[0]) << 8 |
+		    static_cast<uint32_t>(p[1]) << 16 |
+		    static_cast<uint32_t>(p[2]) << 24) >> 8;
+	else
+		return static_cast<int32_t>(
+		    static_cast<uint32_t>(p[0]) |
+		    static_cast<uint32_t>(p[1]) << 8 |
+		    static_cast<uint32_t>(p[2]) << 16 |
+		    static_cast<uint32_t>(p[3]) << 24);
+}
+
+// With Channels fixed, rather than 0 for any, the channel loop is unrolled
+// and the compiler can vectorize across samples.
+
+template <int Bytes, int Channels>
+void
+deinterleave_pcm(const uint8_t *in, int32_t *out, int channels,
+    int64_t samples) {
+	if constexpr (Channels)
+		channels = Channels;
+	for (int64_t sample = 0; sample < samples; sample++) {
+		int32_t *pos = out + sample;
+		for (int channel = 0; channel < channels; channel++) {
+			*pos = read_sample<Bytes>(in);
+			in += Bytes;
+			pos += samples;
+		}
+	}
+}
+
+template <int Channels>
+void
+deinterleave_int(const int32_t *in, int32_t *out, int channels,
+    int64_t samples, int shamt) {
+	if constexpr (Channels)
+		channels = Channels;
+	for (int64_t sample = 0; sample < samples; sample++) {
+		int32_t *pos = out + sample;
+		for (int channel = 0; channel < channels; channel++) {
+			*pos = *in++ >> shamt;
+			pos += samples;
+		}
+	}
+}
+
+//! Mono, stereo and 5.1 get kernels of their own.
+template <int Bytes>
+flacsplit::Pcm_deinterleaver
+pcm_kernel(int channels) {
+	switch (channels) {
+	case 1:  return deinterleave_pcm<Bytes, 1>;
+	case 2:  return deinterleave_pcm<Bytes, 2>;
+	case 6:  return deinterleave_pcm<Bytes, 6>;
+	default: return deinterleave_pcm<Bytes, 0>;
+	}
+}
+
+#ifdef FLACSPLIT_X86
+
+// The vector kernels below only handle stereo; they do whole vectors and
+// leave the last few samples (from 'begin' on) to these.
+
+template <int Bytes>
+inline void
+stereo_tail(const uint8_t *in, int32_t *left, int32_t *right, int64_t begin,
+    int64_t samples) {
+	in += begin * 2 * Bytes;
+	for (int64_t i = begin; i < samples; i++) {
+		left[i] = read_sample<Bytes>(in);
+		right[i] = read_sample<Bytes>(in + Bytes);
+		in += 2 * Bytes;
+	}
+}
+
+inline void
+stereo_tail(const int32_t *in, int32_t *left, int32_t *right, int64_t begin,
+    int64_t samples, int shamt) {
+	in += begin * 2;
+	for (int64_t i = begin; i < samples; i++) {
+		left[i] = in[0] >> shamt;
+		right[i] = in[1] >> shamt;
+		in += 2;
+	}
+}
+
+// Each 32-bit lane holds one 16-bit stereo pair: left in the low half.
+void
+deinterleave_s16_2ch_sse2(const uint8_t *in, int32_t *out, int,
+    int64_t samples) {
+	int32_t *left = out;
+	int32_t *right = out + samples;
+	int64_t i = 0;
+	for (; i + 4 <= samples; i += 4) {
+		__m128i v = _mm_loadu_si128(
+		    reinterpret_cast<const __m128i *>(in + i * 4));
+		__m128i l = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+		__m128i r = _mm_srai_epi32(v, 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(left + i), l);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(right + i), r);
+	}
+	stereo_tail<2>(in, left, right, i, samples);
+}
+
+__attribute__((target("avx2")))
+void
+deinterleave_s16_2ch_avx2(const uint8_t *in, int32_t *out, int,
+    int64_t samples) {
+	int32_t *left = out;
+	int32_t *right = out + samples;
+	int64_t i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		__m256i v = _mm256_loadu_si256(
+		    reinterpret_cast<const __m256i *>(in + i * 4));
+		__m256i l = _mm256_srai_epi32(
+		    _mm256_slli_epi32(v, 16), 16);
+		__m256i r = _mm256_srai_epi32(v, 16);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(left + i),
+		    l);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(right + i),
+		    r);
+	}
+	stereo_tail<2>(in, left, right, i, samples);
+}
+
+// Shuffles two 24-bit stereo pairs (12 bytes) into [L0 L1 R0 R1], each
+// sample in the top three bytes of its lane, ready for an arithmetic shift.
+#define S24_SHUFFLE \
+	-1, 0, 1, 2,  -1, 6, 7, 8,  -1, 3, 4, 5,  -1, 9, 10, 11
+
+// Loads overrun the last pair they use by four bytes, so these stop short
+// of the end of the input.
+__attribute__((target("ssse3")))
+void
+deinterleave_s24_2ch_ssse3(const uint8_t *in, int32_t *out, int,
+    int64_t samples) {
+	const __m128i shuffle = _mm_setr_epi8(S24_SHUFFLE);
+	int32_t *left = out;
+	int32_t *right = out + samples;
+	int64_t i = 0;
+	for (; i + 5 <= samples; i += 4) {
+		const uint8_t *p = in + i * 6;
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128(
+		    reinterpret_cast<const __m128i *>(p)), shuffle);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128(
+		    reinterpret_cast<const __m128i *>(p + 12)), shuffle);
+		__m128i l = _mm_srai_epi32(_mm_unpacklo_epi64(a, b), 8);
+		__m128i r = _mm_srai_epi32(_mm_unpackhi_epi64(a, b), 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(left + i), l);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(right + i), r);
+	}
+	stereo_tail<3>(in, left, right, i, samples);
+}
+
+__attribute__((target("avx2")))
+inline __m256i
+load_halves(const uint8_t *lo, const uint8_t *hi) {
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(
+	    _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo))),
+	    _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)), 1);
+}
+
+__attribute__((target("avx2")))
+void
+deinterleave_s24_2ch_avx2(const uint8_t *in, int32_t *out, int,
+    int64_t samples) {
+	const __m256i shuffle = _mm256_setr_epi8(S24_SHUFFLE, S24_SHUFFLE);
+	int32_t *left = out;
+	int32_t *right = out + samples;
+	int64_t i = 0;
+	for (; i + 9 <= samples; i += 8) {
+		const uint8_t *p = in + i * 6;
+		// [L0 L1 R0 R1 | L2 L3 R2 R3], [L4 L5 R4 R5 | L6 L7 R6 R7]
+		__m256i a = _mm256_shuffle_epi8(load_halves(p, p + 12),
+		    shuffle);
+		__m256i b = _mm256_shuffle_epi8(load_halves(p + 24, p + 36),
+		    shuffle);
+		// [L0 L1 L4 L5 | L2 L3 L6 L7] => [L0 L1 L2 L3 | L4 L5 L6 L7]
+		__m256i l = _mm256_permute4x64_epi64(
+		    _mm256_unpacklo_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i r = _mm256_permute4x64_epi64(
+		    _mm256_unpackhi_epi64(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(left + i),
+		    _mm256_srai_epi32(l, 8));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(right + i),
+		    _mm256_srai_epi32(r, 8));
+	}
+	stereo_tail<3>(in, left, right, i, samples);
+}
+
+#undef S24_SHUFFLE
+
+void
+deinterleave_int_2ch_sse2(const int32_t *in, int32_t *out, int,
+    int64_t samples, int shamt) {
+	const __m128i count = _mm_cvtsi32_si128(shamt);
+	int32_t *left = out;
+	int32_t *right = out + samples;
+	int64_t i = 0;
+	for (; i + 4 <= samples; i += 4) {
+		const __m128i *p =
+		    reinterpret_cast<const __m128i *>(in + i * 2);
+		// [L0 R0 L1 R1] => [L0 L1 R0 R1]
+		__m128i a = _mm_shuffle_epi32(_mm_loadu_si128(p),
+		    _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i b = _mm_shuffle_epi32(_mm_loadu_si128(p + 1),
+		    _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i l = _mm_sra_epi32(_mm_unpacklo_epi64(a, b), count);
+		__m128i r = _mm_sra_epi32(_mm_unpackhi_epi64(a, b), count);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(left + i), l);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(right + i), r);
+	}
+	stereo_tail(in, left, right, i, samples, shamt);
+}
+
+__attribute__((target("avx2")))
+void
+deinterleave_int_2ch_avx2(const int32_t *in, int32_t *out, int,
+    int64_t samples, int shamt) {
+	const __m128i count = _mm_cvtsi32_si128(shamt);
+	const __m256i evens_odds = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	int32_t *left = out;
+	int32_t *right = out + samples;
+	int64_t i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		const __m256i *p =
+		    reinterpret_cast<const __m256i *>(in + i * 2);
+		// [L0 R0 ... L3 R3] => [L0 L1 L2 L3 | R0 R1 R2 R3]
+		__m256i a = _mm256_permutevar8x32_epi32(
+		    _mm256_loadu_si256(p), evens_odds);
+		__m256i b = _mm256_permutevar8x32_epi32(
+		    _mm256_loadu_si256(p + 1), evens_odds);
+		__m256i l = _mm256_permute2x128_si256(a, b, 0x20);
+		__m256i r = _mm256_permute2x128_si256(a, b, 0x31);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(left + i),
+		    _mm256_sra_epi32(l, count));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(right + i),
+		    _mm256_sra_epi32(r, count));
+	}
+	stereo_tail(in, left, right, i, samples, shamt);
+}
+
+bool
+cpu_supports_avx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+bool
+cpu_supports_ssse3() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+#endif // FLACSPLIT_X86
+
+} // end anon
+
+flacsplit::Pcm_deinterleaver
+flacsplit::pcm_deinterleaver(int bits_per_sample, int channels,
+    Simd max_simd) {
+#ifdef FLACSPLIT_X86
+	bool avx2 = max_simd >= Simd::AVX2 && cpu_supports_avx2();
+	// SSE2 is part of x86-64
+	bool sse = max_simd >= Simd::SSE;
+	if (channels == 2 && bits_per_sample == 16) {
+		if (avx2)
+			return deinterleave_s16_2ch_avx2;
+		if (sse)
+			return deinterleave_s16_2ch_sse2;
+	}
+	if (channels == 2 && bits_per_sample == 24) {
+		if (avx2)
+			return deinterleave_s24_2ch_avx2;
+		if (sse && cpu_supports_ssse3())
+			return deinterleave_s24_2ch_ssse3;
+	}
+#else
+	(void)max_simd;
+#endif
+	switch (bits_per_sample) {
+	case 8:  return pcm_kernel<1>(channels);
+	case 16: return pcm_kernel<2>(channels);
+	case 24: return pcm_kernel<3>(channels);
+	default: return pcm_kernel<4>(channels);
+	}
+}
+
+flacsplit::Int_deinterleaver
+flacsplit::int_deinterleaver(int channels, Simd max_simd) {
+#ifdef FLACSPLIT_X86
+	if (channels == 2) {
+		if (max_simd >= Simd::AVX2 && cpu_supports_avx2())
+			return deinterleave_int_2ch_avx2;
+		if (max_simd >= Simd::SSE)
+			return deinterleave_int_2ch_sse2;
+	}
+#else
+	(void)max_simd;
+#endif
+	switch (channels) {
+	case 1:  return deinterleave_int<1>;
+	case 2:  return deinterleave_int<2>;
+	case 6:  return deinterleave_int<6>;
+	default: return deinterleave_int<0>;
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef FLACSPLIT_DEINTERLEAVE_HPP
+#define FLACSPLIT_DEINTERLEAVE_HPP
+
+#include <cstdint>
+
+namespace flacsplit {
+
+/** Convert interleaved little-endian PCM to planar int32.
+ *
+ * \param in	The interleaved samples
+ * \param out	Where channel \e c goes to out + c * samples
+ * \param channels	Number of channels
+ * \param samples	Number of samples per channel
+ */
+typedef void (*Pcm_deinterleaver)(const uint8_t *in, int32_t *out,
+    int channels, int64_t samples);
+
+/** Convert interleaved, left-justified int32 samples (as returned by
+ * libsndfile) to planar int32, shifting each right by \a shamt.
+ */
+typedef void (*Int_deinterleaver)(const int32_t *in, int32_t *out,
+    int channels, int64_t samples, int shamt);
+
+//! The widest vector instructions a converter may use, so that they can be
+//! compared; only x86-64 has any.
+enum class Simd { NONE, SSE, AVX2 };
+
+/** The fastest converter on this CPU for the given format.
+ *
+ * \param bits_per_sample	8, 16, 24, or 32
+ * \param channels	Number of channels
+ */
+Pcm_deinterleaver	pcm_deinterleaver(int bits_per_sample, int channels,
+			    Simd max_simd=Simd::AVX2);
+
+/** The fastest converter on this CPU for libsndfile's samples.
+ *
+ * \param channels	Number of channels
+ */
+Int_deinterleaver	int_deinterleaver(int channels,
+			    Simd max_simd=Simd::AVX2);
+
+}
+
+#endif
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cstdint>
+#include <format>
 #include <memory>
 
 #include <FLAC++/encoder.h>
@@ -34,7 +36,9 @@ public:
 	    FILE *fp,
 	    const flacsplit::Music_info &track,
 	    int64_t total_samples,
-	    int32_t sample_rate);
+	    int32_t sample_rate,
+	    const flacsplit::Replaygain_stats *gain_stats,
+	    const flacsplit::Encode_options &options);
 
 	virtual ~Flac_encoder() {
 		if (_init)
@@ -59,10 +63,8 @@ protected:
 	FLAC__StreamEncoderTellStatus tell_callback(FLAC__uint64 *) override;
 
 private:
-	virtual void set_meta(const flacsplit::Music_info &track) {
-		set_meta(track, true);
-	}
-	void set_meta(const flacsplit::Music_info &, bool);
+	void set_meta(const flacsplit::Music_info &,
+	    const flacsplit::Replaygain_stats *);
 
 	FLAC__StreamMetadata *cast_metadata(FLAC::Metadata::Prototype &meta) {
 		return const_cast<FLAC__StreamMetadata *>(
@@ -80,7 +82,9 @@ private:
 };
 
 Flac_encoder::Flac_encoder(FILE *fp, const flacsplit::Music_info &track,
-    int64_t total_samples, int32_t sample_rate) :
+    int64_t total_samples, int32_t sample_rate,
+    const flacsplit::Replaygain_stats *gain_stats,
+    const flacsplit::Encode_options &options) :
 	FLAC::Encoder::File(),
 	Basic_encoder(),
 	_padding(),
@@ -89,15 +93,33 @@ Flac_encoder::Flac_encoder(FILE *fp, const flacsplit::Music_info &track,
 	_fp(fp),
 	_init(false)
 {
-	set_compression_level(8);
-	set_do_exhaustive_model_search(true);
+	// the level sets everything else, so it goes first
+	set_compression_level(options.compression_level);
+	set_do_exhaustive_model_search(options.exhaustive_search);
+	if (!options.apodization.empty())
+		set_apodization(options.apodization.c_str());
+	if (options.blocksize) {
+		set_blocksize(options.blocksize);
+		// the streamable subset allows no more than 4608 at 48 kHz or
+		// less, and init() would fail; as with flac's --lax
+		if (options.blocksize > 4608)
+			set_streamable_subset(false);
+	}
+#if FLACPP_API_VERSION_CURRENT >= 11
+	// frames are then handed out to threads; how many libFLAC takes was
+	// checked with max_encoder_threads()
+	if (options.threads > 1 && set_num_threads(options.threads) !=
+	    FLAC__STREAM_ENCODER_SET_NUM_THREADS_OK)
+		throw_traced(Flac_encode_error(std::format(
+		    "can't encode with {} threads", options.threads)));
+#endif
 
 	if (total_samples) {
 		_seek_table.reset(new FLAC::Metadata::SeekTable);
 		_seek_table->template_append_spaced_points_by_samples(
 		    sample_rate * 10, total_samples);
 	}
-	set_meta(track);
+	set_meta(track, gain_stats);
 }
 
 void
@@ -121,61 +143,16 @@ Flac_encoder::add_frame(const struct flacsplit::Frame &frame) {
 		throw_traced(Flac_encode_error(get_state().as_cstring()));
 }
 
+// The ReplayGain tags are written now if \a gain_stats is known, or else
+// left room for in padding.
 void
 Flac_encoder::set_meta(const flacsplit::Music_info &track,
-    bool add_replaygain_padding) {
-	using FLAC::Metadata::VorbisComment;
-
-	const std::string &album = track.album();
-	const std::string &album_artist = track.album_artist();
-	const std::string &artist = track.artist();
-	const std::string &date = track.date();
-	const std::string &genre = track.genre();
-	const std::string &title = track.title();
-	uint8_t tracknum = track.track();
-
-	if (!album.empty())
-		_tag.append_comment(VorbisComment::Entry(
-		    "ALBUM", album.c_str()));
-	if (!album_artist.empty())
-		_tag.append_comment(VorbisComment::Entry(
-		    "ALBUM ARTIST", album_artist.c_str()));
-	if (!artist.empty())
-		_tag.append_comment(VorbisComment::Entry(
-		    "ARTIST", artist.c_str()));
-	if (!date.empty())
-		_tag.append_comment(VorbisComment::Entry(
-		    "DATE", date.c_str()));
-	if (!genre.empty())
-		_tag.append_comment(VorbisComment::Entry(
-		    "GENRE", genre.c_str()));
-	if (!title.empty())
-		_tag.append_comment(VorbisComment::Entry(
-		    "TITLE", title.c_str()));
-	if (tracknum) {
-		_tag.append_comment(VorbisComment::Entry(
-		    "TRACKNUMBER", std::to_string(track.track()).c_str()));
-	}
+    const flacsplit::Replaygain_stats *gain_stats) {
+	unsigned pad_length = flacsplit::make_track_tags(track, gain_stats,
+	    _tag);
 
+	bool add_replaygain_padding = !gain_stats;
 	if (add_replaygain_padding) {
-		// use -10 for gain since this gives the field's maximum
-		// length
-		flacsplit::Replaygain_stats basic_gain_stats;
-		basic_gain_stats.album_gain = -10.0;
-		basic_gain_stats.album_peak = 0.0;
-		basic_gain_stats.track_gain = -10.0;
-		basic_gain_stats.track_peak = 0.0;
-
-		flacsplit::append_replaygain_tags(_tag, basic_gain_stats);
-		unsigned pad_length = _tag.get_length();
-		flacsplit::delete_replaygain_tags(_tag);
-		pad_length -= _tag.get_length();
-
-		// Padding will be used when adding the replaygain tags later.
-		// This will subtract from the padding size. Either we need to
-		// fully consume the padding and header exactly, or we need to
-		// have enough room for a padding header and nothing else. So
-		// don't try to adjust the value to account for the header.
 		if (!_padding)
 			_padding.reset(new FLAC::Metadata::Padding);
 		_padding->set_length(pad_length);
@@ -232,11 +209,97 @@ flacsplit::Encoder::Encoder(
     const Music_info &track,
     int64_t total_samples,
     int32_t sample_rate,
+    const Replaygain_stats *gain_stats,
+    const Encode_options &options,
     file_format file_format
 ) {
 	if (file_format != file_format::FLAC)
 		throw_traced(Bad_format());
 	_encoder.reset(new Flac_encoder(
-	    fp, track, total_samples, sample_rate
+	    fp, track, total_samples, sample_rate, gain_stats, options
 	));
 }
+
+unsigned
+flacsplit::make_track_tags(const Music_info &track,
+    const Replaygain_stats *gain_stats, FLAC::Metadata::VorbisComment &tag) {
+	using FLAC::Metadata::VorbisComment;
+
+	const std::string &album = track.album();
+	const std::string &album_artist = track.album_artist();
+	const std::string &artist = track.artist();
+	const std::string &date = track.date();
+	const std::string &genre = track.genre();
+	const std::string &title = track.title();
+	uint8_t tracknum = track.track();
+
+	if (!album.empty())
+		tag.append_comment(VorbisComment::Entry(
+		    "ALBUM", album.c_str()));
+	if (!album_artist.empty())
+		tag.append_comment(VorbisComment::Entry(
+		    "ALBUM ARTIST", album_artist.c_str()));
+	if (!artist.empty())
+		tag.append_comment(VorbisComment::Entry(
+		    "ARTIST", artist.c_str()));
+	if (!date.empty())
+		tag.append_comment(VorbisComment::Entry(
+		    "DATE", date.c_str()));
+	if (!genre.empty())
+		tag.append_comment(VorbisComment::Entry(
+		    "GENRE", genre.c_str()));
+	if (!title.empty())
+		tag.append_comment(VorbisComment::Entry(
+		    "TITLE", title.c_str()));
+	if (tracknum) {
+		tag.append_comment(VorbisComment::Entry(
+		    "TRACKNUMBER", std::to_string(track.track()).c_str()));
+	}
+
+	if (gain_stats) {
+		append_replaygain_tags(tag, *gain_stats);
+		return 0;
+	}
+
+	// use -10 for gain since this gives the field's maximum
+	// length
+	Replaygain_stats basic_gain_stats;
+	basic_gain_stats.album_gain = -10.0;
+	basic_gain_stats.album_peak = 0.0;
+	basic_gain_stats.track_gain = -10.0;
+	basic_gain_stats.track_peak = 0.0;
+
+	append_replaygain_tags(tag, basic_gain_stats);
+	unsigned pad_length = tag.get_length();
+	delete_replaygain_tags(tag);
+	pad_length -= tag.get_length();
+
+	// Padding will be used when adding the replaygain tags later.
+	// This will subtract from the padding size. Either we need to
+	// fully consume the padding and header exactly, or we need to
+	// have enough room for a padding header and nothing else. So
+	// don't try to adjust the value to account for the header.
+	return pad_length;
+}
+
+unsigned
+flacsplit::max_encoder_threads(unsigned wanted) {
+#if FLACPP_API_VERSION_CURRENT >= 11
+	// libFLAC doesn't say what its limit is, so look for it
+	FLAC::Encoder::File encoder;
+	unsigned low = 1;
+	unsigned high = std::max(wanted, 1U);
+	while (low < high) {
+		unsigned mid = high - (high - low) / 2;
+		if (encoder.set_num_threads(mid) ==
+		    FLAC__STREAM_ENCODER_SET_NUM_THREADS_OK)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	return low;
+#else
+	(void)wanted;
+	return 1;
+#endif
+}
@@ -3,12 +3,35 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 
 #include "transcode.hpp"
 
+namespace FLAC {
+	namespace Metadata {
+		class VorbisComment;
+	}
+}
+
 namespace flacsplit {
 
 struct Encode_error : std::exception {};
+struct Replaygain_stats;
+
+//! How hard the FLAC encoder works. The defaults are flac(1)'s --best plus
+//! an exhaustive model search.
+struct Encode_options {
+	//! 0 (fastest) to 8 (smallest), as flac(1)'s -0 to -8
+	unsigned	compression_level = 8;
+	bool		exhaustive_search = true;
+	//! As flac(1)'s -A; empty for the compression level's own
+	std::string	apodization;
+	//! In samples; 0 for the compression level's own. Over 4608 leaves
+	//! the streamable subset.
+	unsigned	blocksize = 0;
+	//! How many threads to encode a stream with, where libFLAC can
+	unsigned	threads = 1;
+};
 
 class Basic_encoder {
 public:
@@ -30,12 +53,17 @@ public:
 		}
 	};
 
+	//! \param gain_stats	The final ReplayGain values, if already
+	//!	known; otherwise room is left to add them later
 	//! \throw Bad_format
+	//! \throw Encode_error	If libFLAC won't take \a options
 	Encoder(
 	    FILE *fp,
 	    const Music_info &track,
 	    int64_t total_samples,
 	    int32_t sample_rate,
+	    const Replaygain_stats *gain_stats=nullptr,
+	    const Encode_options &options=Encode_options(),
 	    file_format=file_format::FLAC);
 
 	//! \throw Encode_error
@@ -51,6 +79,20 @@ private:
 	std::unique_ptr<Basic_encoder>	_encoder;
 };
 
+/** Fill in the tags a track is written with.
+ *
+ * \param gain_stats	The final ReplayGain values, if already known
+ * \return	How much padding to leave for the ReplayGain tags, if they
+ *	are to be added later
+ */
+unsigned	make_track_tags(const Music_info &track,
+		    const Replaygain_stats *gain_stats,
+		    FLAC::Metadata::VorbisComment &tag);
+
+//! The most threads, up to \a wanted, that libFLAC can encode a stream
+//! with. More than one takes 1.5.0 built with threads.
+unsigned	max_encoder_threads(unsigned wanted);
+
 }
 
 #endif
@@ -0,0 +1,802 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstring>
+#include <format>
+#include <vector>
+
+#include <FLAC++/decoder.h>
+#include <FLAC++/encoder.h>
+#include <FLAC++/metadata.h>
+
+#include "errors.hpp"
+#include "flac_copy.hpp"
+#include "md5.hpp"
+#include "replaygain_writer.hpp"
+
+namespace {
+
+using Copy_error = flacsplit::Flac_copier::Copy_error;
+
+const unsigned STREAMINFO_LENGTH = 34;
+// as the encoder's
+const unsigned SEEKPOINT_SECONDS = 10;
+const unsigned MAX_BLOCKSIZE = 65535;
+// the smallest block allowed anywhere but at the end of a stream
+const unsigned MIN_BLOCKSIZE = 16;
+
+//! What's needed out of the STREAMINFO block.
+struct Stream_format {
+	int32_t		sample_rate;
+	int		channels;
+	int		bits_per_sample;
+	int64_t		total_samples;
+	unsigned	blocksize;
+};
+
+template <typename T, int Bits, T Poly>
+constexpr std::array<T, 256>
+make_crc_table() {
+	std::array<T, 256> table{};
+	for (unsigned i = 0; i < 256; i++) {
+		T crc = static_cast<T>(i << (Bits - 8));
+		for (int bit = 0; bit < 8; bit++)
+			crc = crc & (T(1) << (Bits - 1)) ?
+			    static_cast<T>(crc << 1 ^ Poly) :
+			    static_cast<T>(crc << 1);
+		table[i] = crc;
+	}
+	return table;
+}
+
+constexpr auto CRC8_TABLE = make_crc_table<uint8_t, 8, 0x07>();
+constexpr auto CRC16_TABLE = make_crc_table<uint16_t, 16, 0x8005>();
+
+//! The CRC-8 that ends a FLAC frame header.
+uint8_t
+crc8(const uint8_t *p, size_t len) {
+	uint8_t crc = 0;
+	while (len--)
+		crc = CRC8_TABLE[crc ^ *p++];
+	return crc;
+}
+
+//! The CRC-16 that ends a FLAC frame.
+uint16_t
+crc16(const uint8_t *p, size_t len) {
+	uint16_t crc = 0;
+	while (len--)
+		crc = static_cast<uint16_t>(crc << 8) ^
+		    CRC16_TABLE[(crc >> 8) ^ *p++];
+	return crc;
+}
+
+//! The length of the UTF-8-like coded number that starts with \a lead, or 0
+//! if it's no such thing.
+size_t
+coded_number_length(uint8_t lead) {
+	if (lead < 0x80) return 1;
+	if ((lead & 0xe0) == 0xc0) return 2;
+	if ((lead & 0xf0) == 0xe0) return 3;
+	if ((lead & 0xf8) == 0xf0) return 4;
+	if ((lead & 0xfc) == 0xf8) return 5;
+	if ((lead & 0xfe) == 0xfc) return 6;
+	if (lead == 0xfe) return 7;
+	return 0;
+}
+
+void
+append_coded_number(std::vector<uint8_t> &out, uint64_t n) {
+	if (n < 0x80) {
+		out.push_back(n);
+		return;
+	}
+	int bytes = n < 0x800 ? 2 : n < 0x10000 ? 3 : n < 0x200000 ? 4 :
+	    n < 0x4000000 ? 5 : n < 0x80000000 ? 6 : 7;
+	// as many leading ones as bytes, then the top bits
+	out.push_back(static_cast<uint8_t>(0xff00 >> bytes) |
+	    n >> 6 * (bytes - 1));
+	for (int i = bytes - 2; i >= 0; i--)
+		out.push_back(0x80 | (n >> 6 * i & 0x3f));
+}
+
+//! The length of a frame's header, up to and including its CRC-8, or 0 if
+//! it's not a frame.
+size_t
+frame_header_length(const uint8_t *frame, size_t len) {
+	if (len < 6 || frame[0] != 0xff || (frame[1] & 0xfe) != 0xf8)
+		return 0;
+	size_t number_len = coded_number_length(frame[4]);
+	if (!number_len)
+		return 0;
+
+	size_t header_len = 4 + number_len;
+	switch (frame[2] >> 4) {
+	case 6:	header_len += 1; break;
+	case 7:	header_len += 2; break;
+	}
+	switch (frame[2] & 0xf) {
+	case 12:	header_len += 1; break;
+	case 13:
+	case 14:	header_len += 2; break;
+	}
+	header_len++;
+	// room for the footer, too
+	return header_len + 2 <= len ? header_len : 0;
+}
+
+//! Append \a frame to \a out, renumbered to start at sample \a sample. The
+//! frame becomes a variable block size one, since the frames at track
+//! boundaries are of any size, and both its CRCs are redone.
+void
+append_renumbered(std::vector<uint8_t> &out, const uint8_t *frame,
+    size_t len, uint64_t sample) {
+	size_t header_len = frame_header_length(frame, len);
+	if (!header_len)
+		flacsplit::throw_traced(Copy_error("bad FLAC frame header"));
+	size_t number_len = coded_number_length(frame[4]);
+
+	size_t start = out.size();
+	out.insert(out.end(), frame, frame + 4);
+	out[start + 1] |= 0x01;
+	append_coded_number(out, sample);
+	// the block size and sample rate, if they don't fit in their codes
+	out.insert(out.end(), frame + 4 + number_len, frame + header_len - 1);
+	out.push_back(crc8(&out[start], out.size() - start));
+
+	out.insert(out.end(), frame + header_len, frame + len - 2);
+	uint16_t crc = crc16(&out[start], out.size() - start);
+	out.push_back(crc >> 8);
+	out.push_back(crc & 0xff);
+}
+
+void
+append_be(std::vector<uint8_t> &out, uint64_t value, int bytes) {
+	while (bytes--)
+		out.push_back(value >> 8 * bytes);
+}
+
+void
+append_le32(std::vector<uint8_t> &out, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		out.push_back(value >> 8 * i);
+}
+
+void
+append_block_header(std::vector<uint8_t> &out, int type, bool last,
+    uint32_t len) {
+	out.push_back((last ? 0x80 : 0) | type);
+	append_be(out, len, 3);
+}
+
+//! The decoder for the frames being copied. It's only asked for one frame
+//! at a time, so the last one is all it keeps.
+class Copy_decoder : public FLAC::Decoder::File {
+public:
+	Copy_decoder() :
+		FLAC::Decoder::File(),
+		_header(),
+		_data(),
+		_status(nullptr)
+	{}
+
+	//! \throw Copy_error
+	void next_frame() {
+		_status = nullptr;
+		_header.blocksize = 0;
+		if (!process_single())
+			flacsplit::throw_traced(Copy_error(
+			    get_state().as_cstring()));
+		check();
+	}
+
+	//! \throw Copy_error
+	void seek_frame(int64_t sample) {
+		_status = nullptr;
+		_header.blocksize = 0;
+		if (!seek_absolute(sample))
+			flacsplit::throw_traced(Copy_error(
+			    get_state().as_cstring()));
+		check();
+	}
+
+	//! Where the last frame decoded ends.
+	//! \throw Copy_error
+	uint64_t position() const {
+		FLAC__uint64 position;
+		if (!get_decode_position(&position))
+			flacsplit::throw_traced(Copy_error(
+			    "no decode position"));
+		return position;
+	}
+
+	const FLAC__FrameHeader &header() const {
+		return _header;
+	}
+
+	const FLAC__int32 *const *data() const {
+		return _data.data();
+	}
+
+protected:
+	FLAC__StreamDecoderWriteStatus write_callback(
+	    const FLAC__Frame *frame, const FLAC__int32 *const *buffer)
+	    override {
+		_header = frame->header;
+		_data.assign(buffer, buffer + frame->header.channels);
+		return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+	}
+
+	void error_callback(FLAC__StreamDecoderErrorStatus status) override {
+		_status = FLAC__StreamDecoderErrorStatusString[status];
+	}
+
+private:
+	void check() {
+		if (_status)
+			flacsplit::throw_traced(Copy_error(_status));
+		if (get_state() == FLAC__STREAM_DECODER_END_OF_STREAM ||
+		    !_header.blocksize)
+			flacsplit::throw_traced(Copy_error(
+			    "ran out of frames"));
+	}
+
+	FLAC__FrameHeader		_header;
+	std::vector<const FLAC__int32 *>	_data;
+	const char			*_status;
+};
+
+//! Encodes samples as a single frame, for the edges of a track.
+class Edge_encoder : public FLAC::Encoder::Stream {
+public:
+	//! \throw Copy_error
+	Edge_encoder(const Stream_format &format,
+	    const flacsplit::Encode_options &options, unsigned samples) :
+		FLAC::Encoder::Stream(),
+		_frame(),
+		_frames(0)
+	{
+		set_channels(format.channels);
+		set_bits_per_sample(format.bits_per_sample);
+		set_sample_rate(format.sample_rate);
+		set_compression_level(options.compression_level);
+		set_do_exhaustive_model_search(options.exhaustive_search);
+		if (!options.apodization.empty())
+			set_apodization(options.apodization.c_str());
+		// one block for the lot; a shorter one is only ever the
+		// last of a stream, which is fine
+		set_blocksize(std::max(samples, MIN_BLOCKSIZE));
+		set_streamable_subset(samples <= 4608);
+		set_do_md5(false);
+
+		FLAC__StreamEncoderInitStatus status = init();
+		if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+			flacsplit::throw_traced(Copy_error(
+			    FLAC__StreamEncoderInitStatusString[status]));
+	}
+
+	//! \throw Copy_error
+	const std::vector<uint8_t> &encode(const FLAC__int32 *const *data,
+	    unsigned samples) {
+		if (!process(data, samples) || !finish())
+			flacsplit::throw_traced(Copy_error(
+			    get_state().as_cstring()));
+		if (_frames != 1)
+			flacsplit::throw_traced(Copy_error(
+			    "expected a single frame"));
+		return _frame;
+	}
+
+protected:
+	FLAC__StreamEncoderWriteStatus write_callback(const FLAC__byte *buffer,
+	    size_t bytes, uint32_t samples, uint32_t /*current_frame*/)
+	    override {
+		// the stream header and metadata have no samples, and aren't
+		// wanted
+		if (samples) {
+			_frame.insert(_frame.end(), buffer, buffer + bytes);
+			_frames++;
+		}
+		return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+	}
+
+private:
+	std::vector<uint8_t>	_frame;
+	unsigned		_frames;
+};
+
+//! A track being written: the frames, and what STREAMINFO and the seek
+//! table will say of them.
+class Track_writer {
+public:
+	Track_writer(FILE *fp, const Stream_format &format,
+	    int64_t total_samples) :
+		_md5(),
+		_buf(),
+		_format(format),
+		_fp(fp),
+		_samples(0),
+		_min_blocksize(UINT_MAX),
+		_max_blocksize(0),
+		_last_blocksize(0),
+		_min_framesize(UINT_MAX),
+		_max_framesize(0),
+		_seek_targets(),
+		_next_seek_target(0),
+		_seek_points(),
+		_frame_bytes(0)
+	{
+		// as FLAC::Metadata::SeekTable's
+		// template_append_spaced_points_by_samples()
+		for (int64_t sample = 0; sample < total_samples;
+		    sample += _format.sample_rate * SEEKPOINT_SECONDS)
+			_seek_targets.push_back(sample);
+	}
+
+	int64_t samples() const {
+		return _samples;
+	}
+
+	//! Add decoded samples to the MD5 signature, which is of the samples
+	//! interleaved, little-endian, in as few bytes as they fit.
+	void sign(const FLAC__int32 *const *data, int64_t samples) {
+		int bytes = (_format.bits_per_sample + 7) / 8;
+		_buf.clear();
+		for (int64_t i = 0; i < samples; i++)
+			for (int c = 0; c < _format.channels; c++) {
+				uint32_t sample = data[c][i];
+				for (int b = 0; b < bytes; b++)
+					_buf.push_back(sample >> 8 * b);
+			}
+		_md5.update(_buf.data(), _buf.size());
+	}
+
+	//! Write out \a frame, renumbered to follow the last.
+	//! \throw Copy_error
+	//! \throw flacsplit::Unix_error
+	void write_frame(const uint8_t *frame, size_t len, unsigned samples) {
+		_buf.clear();
+		append_renumbered(_buf, frame, len, _samples);
+		write(_buf);
+
+		// the last block doesn't count for the minimum
+		if (_last_blocksize)
+			_min_blocksize = std::min(_min_blocksize,
+			    _last_blocksize);
+		_last_blocksize = samples;
+		_max_blocksize = std::max(_max_blocksize, samples);
+		_min_framesize = std::min<unsigned>(_min_framesize,
+		    _buf.size());
+		_max_framesize = std::max<unsigned>(_max_framesize,
+		    _buf.size());
+
+		// the frame is the seek point for any target within it
+		bool seek_point = false;
+		for (; _next_seek_target < _seek_targets.size() &&
+		    _seek_targets[_next_seek_target] < _samples + samples;
+		    _next_seek_target++)
+			seek_point = true;
+		if (seek_point)
+			_seek_points.push_back(Seek_point{
+			    .sample=static_cast<uint64_t>(_samples),
+			    .offset=_frame_bytes, .samples=samples,
+			});
+
+		_frame_bytes += _buf.size();
+		_samples += samples;
+	}
+
+	//! \throw flacsplit::Unix_error
+	void write(const std::vector<uint8_t> &bytes) {
+		if (fwrite(bytes.data(), 1, bytes.size(), _fp) !=
+		    bytes.size())
+			flacsplit::throw_traced(flacsplit::Unix_error(
+			    "write failed"));
+	}
+
+	//! The STREAMINFO block, less its header, once all the frames are in.
+	std::vector<uint8_t> stream_info() {
+		unsigned min_blocksize = _min_blocksize == UINT_MAX ?
+		    _last_blocksize : _min_blocksize;
+		std::vector<uint8_t> info;
+		append_be(info, min_blocksize, 2);
+		append_be(info, _max_blocksize, 2);
+		append_be(info, _min_framesize == UINT_MAX ? 0 :
+		    _min_framesize, 3);
+		append_be(info, _max_framesize, 3);
+		append_be(info,
+		    static_cast<uint64_t>(_format.sample_rate) << 44 |
+		    static_cast<uint64_t>(_format.channels - 1) << 41 |
+		    static_cast<uint64_t>(_format.bits_per_sample - 1) << 36 |
+		    static_cast<uint64_t>(_samples), 8);
+		auto md5 = _md5.digest();
+		info.insert(info.end(), md5.begin(), md5.end());
+		return info;
+	}
+
+	//! The SEEKTABLE block, less its header, as far as the frames so far
+	//! go; empty for no seek table. Targets that no frame was found for,
+	//! or that shared a frame with another, are left placeholders, which
+	//! go last.
+	std::vector<uint8_t> seek_table() const {
+		std::vector<uint8_t> table;
+		for (size_t i = 0; i < _seek_targets.size(); i++) {
+			if (i < _seek_points.size()) {
+				const Seek_point &point = _seek_points[i];
+				append_be(table, point.sample, 8);
+				append_be(table, point.offset, 8);
+				append_be(table, point.samples, 2);
+			} else {
+				append_be(table,
+				    FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER,
+				    8);
+				append_be(table, 0, 8);
+				append_be(table, 0, 2);
+			}
+		}
+		return table;
+	}
+
+private:
+	struct Seek_point {
+		uint64_t	sample;
+		// from the first frame
+		uint64_t	offset;
+		unsigned	samples;
+	};
+
+	flacsplit::Md5		_md5;
+	std::vector<uint8_t>	_buf;
+	Stream_format		_format;
+	FILE			*_fp;
+	int64_t			_samples;
+	unsigned		_min_blocksize;
+	unsigned		_max_blocksize;
+	unsigned		_last_blocksize;
+	unsigned		_min_framesize;
+	unsigned		_max_framesize;
+	// the samples the seek points are wanted at, and the next one to
+	// find a frame for
+	std::vector<int64_t>	_seek_targets;
+	size_t			_next_seek_target;
+	std::vector<Seek_point>	_seek_points;
+	uint64_t		_frame_bytes;
+};
+
+//! Read the STREAMINFO block, which must come first.
+bool
+read_stream_format(FILE *fp, Stream_format *format) {
+	uint8_t head[8 + STREAMINFO_LENGTH];
+	if (fread(head, sizeof(head), 1, fp) != 1 ||
+	    memcmp(head, "fLaC", 4) ||
+	    (head[4] & 0x7f) != FLAC__METADATA_TYPE_STREAMINFO)
+		return false;
+
+	const uint8_t *info = head + 8;
+	unsigned min_blocksize = info[0] << 8 | info[1];
+	unsigned max_blocksize = info[2] << 8 | info[3];
+	uint64_t bits = 0;
+	for (int i = 10; i < 18; i++)
+		bits = bits << 8 | info[i];
+	format->sample_rate = bits >> 44;
+	format->channels = (bits >> 41 & 0x7) + 1;
+	format->bits_per_sample = (bits >> 36 & 0x1f) + 1;
+	format->total_samples = bits & 0xfffffffffULL;
+	format->blocksize = max_blocksize;
+
+	// frames can only be found by sample number with a fixed block size,
+	// and the length must be known to check a track against it
+	return min_blocksize == max_blocksize && format->total_samples &&
+	    max_blocksize + MIN_BLOCKSIZE <= MAX_BLOCKSIZE;
+}
+
+} // end anon
+
+namespace flacsplit {
+
+class Flac_copier_impl {
+public:
+	Flac_copier_impl(FILE *fp, const Stream_format &format,
+	    const Encode_options &options) :
+		_decoder(),
+		_format(format),
+		_options(options),
+		_pending(format.channels),
+		_pending_ptrs(format.channels),
+		_view(format.channels),
+		_frame(),
+		_fp(fp),
+		_first_frame(0)
+	{
+		FLAC__StreamDecoderInitStatus status = _decoder.init(fp);
+		if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK)
+			throw_traced(Copy_error(
+			    FLAC__StreamDecoderInitStatusString[status]));
+		if (!_decoder.process_until_end_of_metadata())
+			throw_traced(Copy_error(
+			    _decoder.get_state().as_cstring()));
+		_first_frame = _decoder.position();
+	}
+
+	void copy(FILE *out, int64_t begin, int64_t samples,
+	    const Music_info &track, const Replaygain_stats *gain_stats,
+	    const std::function<void(const Frame &)> &on_frame);
+
+	const Stream_format &format() const {
+		return _format;
+	}
+
+private:
+	void write_header(Track_writer &, const Music_info &,
+	    const Replaygain_stats *);
+	void add_pending(const FLAC__int32 *const *data, int64_t begin,
+	    int64_t samples);
+	void flush_pending(Track_writer &);
+	void read_frame(uint64_t begin, uint64_t end);
+
+	Copy_decoder			_decoder;
+	Stream_format			_format;
+	Encode_options			_options;
+	// the samples to be encoded again, at a track boundary
+	std::vector<std::vector<FLAC__int32>>	_pending;
+	std::vector<const FLAC__int32 *>	_pending_ptrs;
+	std::vector<const FLAC__int32 *>	_view;
+	std::vector<uint8_t>		_frame;
+	// owned by _decoder
+	FILE				*_fp;
+	// where the metadata ends
+	uint64_t			_first_frame;
+};
+
+}
+
+void
+flacsplit::Flac_copier_impl::copy(FILE *out, int64_t begin, int64_t samples,
+    const Music_info &track, const Replaygain_stats *gain_stats,
+    const std::function<void(const Frame &)> &on_frame) {
+	int64_t end = begin + samples;
+	if (samples <= 0 || end > _format.total_samples)
+		throw_traced(Copy_error(std::format(
+		    "samples [{}, {}) not in stream", begin, end)));
+
+	off_t header_offset = ftello(out);
+	Track_writer writer(out, _format, samples);
+	write_header(writer, track, gain_stats);
+
+	for (auto &channel : _pending)
+		channel.clear();
+
+	// The frame seeked to is decoded by the seek, so where it starts is
+	// only known for the stream's first; another's samples are encoded
+	// again. A track that starts on a later frame seeks to the one before
+	// it instead, so that its first frame can be copied. Where any frame
+	// after the one seeked to starts is where the one before it ended.
+	int64_t frame_begin = begin - begin % _format.blocksize;
+	bool aligned = frame_begin == begin;
+	uint64_t byte_begin = 0;
+	uint64_t byte_end = 0;
+	// whether the frame's bytes are known
+	bool known = false;
+	if (aligned && frame_begin)
+		_decoder.seek_frame(frame_begin - _format.blocksize);
+	else {
+		_decoder.seek_frame(frame_begin);
+		if (aligned) {
+			byte_begin = _first_frame;
+			byte_end = _decoder.position();
+			known = true;
+		}
+	}
+	for (bool next = aligned && frame_begin; ; next = true) {
+		if (next) {
+			byte_begin = _decoder.position();
+			_decoder.next_frame();
+			byte_end = _decoder.position();
+			known = true;
+		}
+
+		const FLAC__FrameHeader &header = _decoder.header();
+		if (header.number_type != FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER
+		    || static_cast<int64_t>(header.number.sample_number) !=
+		    frame_begin)
+			throw_traced(Copy_error("frame out of place"));
+		int64_t frame_end = frame_begin + header.blocksize;
+
+		// the part of the frame in the track
+		int64_t part_begin = std::max(frame_begin, begin);
+		int64_t part_end = std::min(frame_end, end);
+		for (int c = 0; c < _format.channels; c++)
+			_view[c] = _decoder.data()[c] +
+			    (part_begin - frame_begin);
+
+		Frame frame;
+		frame.data = _view.data();
+		frame.bits_per_sample = header.bits_per_sample;
+		frame.channels = header.channels;
+		frame.samples = part_end - part_begin;
+		frame.rate = header.sample_rate;
+		on_frame(frame);
+		writer.sign(_view.data(), frame.samples);
+
+		// a short block can't be followed by another, so a short
+		// beginning takes the next frame with it
+		bool whole = known && part_begin == frame_begin &&
+		    part_end == frame_end;
+		size_t pending = _pending[0].size();
+		if (whole && (!pending || pending >= MIN_BLOCKSIZE)) {
+			flush_pending(writer);
+			read_frame(byte_begin, byte_end);
+			writer.write_frame(_frame.data(), _frame.size(),
+			    header.blocksize);
+		} else {
+			if (pending + frame.samples > MAX_BLOCKSIZE)
+				flush_pending(writer);
+			add_pending(_view.data(), 0, frame.samples);
+		}
+
+		frame_begin = frame_end;
+		if (frame_end >= end)
+			break;
+	}
+	flush_pending(writer);
+
+	// go back and fill in STREAMINFO, and the seek table that follows it
+	std::vector<uint8_t> stream_info = writer.stream_info();
+	std::vector<uint8_t> seek_table = writer.seek_table();
+	if (fseeko(out, header_offset + 8, SEEK_SET) ||
+	    fwrite(stream_info.data(), 1, stream_info.size(), out) !=
+	    stream_info.size() ||
+	    (!seek_table.empty() && (fseeko(out, 4, SEEK_CUR) ||
+	    fwrite(seek_table.data(), 1, seek_table.size(), out) !=
+	    seek_table.size())) ||
+	    fseeko(out, 0, SEEK_END))
+		throw_traced(Unix_error("write failed"));
+}
+
+void
+flacsplit::Flac_copier_impl::write_header(Track_writer &writer,
+    const Music_info &track, const Replaygain_stats *gain_stats) {
+	FLAC::Metadata::VorbisComment tag;
+	unsigned pad_length = make_track_tags(track, gain_stats, tag);
+
+	std::vector<uint8_t> header{'f', 'L', 'a', 'C'};
+	// STREAMINFO is filled in at the end
+	append_block_header(header, FLAC__METADATA_TYPE_STREAMINFO, false,
+	    STREAMINFO_LENGTH);
+	header.resize(header.size() + STREAMINFO_LENGTH);
+
+	// as the encoder writes, and also filled in at the end
+	std::vector<uint8_t> seek_table = writer.seek_table();
+	if (!seek_table.empty()) {
+		append_block_header(header, FLAC__METADATA_TYPE_SEEKTABLE,
+		    false, seek_table.size());
+		header.insert(header.end(), seek_table.begin(),
+		    seek_table.end());
+	}
+
+	std::vector<uint8_t> comment;
+	const char *vendor = reinterpret_cast<const char *>(
+	    tag.get_vendor_string());
+	size_t vendor_len = vendor ? strlen(vendor) : 0;
+	append_le32(comment, vendor_len);
+	comment.insert(comment.end(), vendor, vendor + vendor_len);
+	append_le32(comment, tag.get_num_comments());
+	for (unsigned i = 0; i < tag.get_num_comments(); i++) {
+		FLAC::Metadata::VorbisComment::Entry entry =
+		    tag.get_comment(i);
+		const char *field = entry.get_field();
+		append_le32(comment, entry.get_field_length());
+		comment.insert(comment.end(), field,
+		    field + entry.get_field_length());
+	}
+	append_block_header(header, FLAC__METADATA_TYPE_VORBIS_COMMENT,
+	    !pad_length, comment.size());
+	header.insert(header.end(), comment.begin(), comment.end());
+
+	// as with the encoder, room for ReplayGain tags to be added later
+	if (pad_length) {
+		append_block_header(header, FLAC__METADATA_TYPE_PADDING, true,
+		    pad_length);
+		header.resize(header.size() + pad_length);
+	}
+	writer.write(header);
+}
+
+void
+flacsplit::Flac_copier_impl::add_pending(const FLAC__int32 *const *data,
+    int64_t begin, int64_t samples) {
+	for (int c = 0; c < _format.channels; c++)
+		_pending[c].insert(_pending[c].end(), data[c] + begin,
+		    data[c] + begin + samples);
+}
+
+void
+flacsplit::Flac_copier_impl::flush_pending(Track_writer &writer) {
+	unsigned samples = _pending[0].size();
+	if (!samples)
+		return;
+	for (int c = 0; c < _format.channels; c++)
+		_pending_ptrs[c] = _pending[c].data();
+
+	Edge_encoder encoder(_format, _options, samples);
+	const std::vector<uint8_t> &frame = encoder.encode(
+	    _pending_ptrs.data(), samples);
+	writer.write_frame(frame.data(), frame.size(), samples);
+
+	for (auto &channel : _pending)
+		channel.clear();
+}
+
+void
+flacsplit::Flac_copier_impl::read_frame(uint64_t begin, uint64_t end) {
+	if (end <= begin)
+		throw_traced(Copy_error("bad frame position"));
+	_frame.resize(end - begin);
+	ssize_t len = pread(fileno(_fp), _frame.data(), _frame.size(), begin);
+	if (len < 0)
+		throw_traced(Unix_error("read failed"));
+	if (static_cast<size_t>(len) != _frame.size())
+		throw_traced(Copy_error("short read"));
+
+	// make sure it's the frame that was decoded
+	size_t footer = _frame.size() - 2;
+	if (!frame_header_length(_frame.data(), _frame.size()) ||
+	    crc16(_frame.data(), footer) !=
+	    (_frame[footer] << 8 | _frame[footer + 1]))
+		throw_traced(Copy_error("frame not where it was expected"));
+}
+
+
+
+std::unique_ptr<flacsplit::Flac_copier>
+flacsplit::Flac_copier::open(FILE *fp, const Encode_options &options) {
+	Stream_format format;
+	bool ok = read_stream_format(fp, &format);
+	rewind(fp);
+	if (!ok)
+		return nullptr;
+
+	// the FLAC library takes ownership of the file it decodes, so give
+	// it one of its own
+	int fd = dup(fileno(fp));
+	FILE *copy_fp = fd < 0 ? nullptr : fdopen(fd, "rb");
+	if (!copy_fp) {
+		if (fd >= 0)
+			close(fd);
+		throw_traced(Unix_error("dup failed"));
+	}
+	return std::unique_ptr<Flac_copier>(new Flac_copier(
+	    std::make_unique<Flac_copier_impl>(copy_fp, format, options)));
+}
+
+flacsplit::Flac_copier::Flac_copier(
+    std::unique_ptr<Flac_copier_impl> &&impl) :
+	_impl(std::move(impl))
+{}
+
+flacsplit::Flac_copier::~Flac_copier() {}
+
+int32_t
+flacsplit::Flac_copier::sample_rate() const {
+	return _impl->format().sample_rate;
+}
+
+int64_t
+flacsplit::Flac_copier::total_samples() const {
+	return _impl->format().total_samples;
+}
+
+size_t
+flacsplit::Flac_copier::max_frame_len() const {
+	const Stream_format &format = _impl->format();
+	return static_cast<size_t>(format.blocksize) * format.channels;
+}
+
+void
+flacsplit::Flac_copier::copy(FILE *out, int64_t begin, int64_t samples,
+    const Music_info &track, const Replaygain_stats *gain_stats,
+    const std::function<void(const Frame &)> &on_frame) {
+	_impl->copy(out, begin, samples, track, gain_stats, on_frame);
+}
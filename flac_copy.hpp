@@ -0,0 +1,75 @@
+#ifndef FLACSPLIT_FLAC_COPY_HPP
+#define FLACSPLIT_FLAC_COPY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "encode.hpp"
+#include "transcode.hpp"
+
+namespace flacsplit {
+
+class Flac_copier_impl;
+
+/** Splits tracks out of a FLAC file by copying its encoded frames as they
+ * are. Only the samples in frames that a track boundary falls inside are
+ * encoded again. Every frame is still decoded, for the MD5 signature and
+ * for loudness, but decoding is cheap next to encoding.
+ */
+class Flac_copier {
+public:
+	struct Copy_error : std::exception {
+		Copy_error(const std::string &msg) : msg(msg) {}
+
+		const char *what() const noexcept override {
+			return msg.c_str();
+		}
+
+		std::string msg;
+	};
+
+	/** Copy from \a fp if it's a FLAC stream that can be copied from,
+	 * which means one with a fixed block size; otherwise, return null.
+	 * Either way, \a fp is left rewound and still the caller's to close.
+	 *
+	 * \param options	For encoding the frames at track boundaries
+	 * \throw Copy_error
+	 */
+	static std::unique_ptr<Flac_copier> open(FILE *fp,
+	    const Encode_options &options);
+
+	~Flac_copier();
+
+	int32_t sample_rate() const;
+
+	int64_t total_samples() const;
+
+	//! The most samples, over all channels, that a frame passed to
+	//! copy()'s \a on_frame may hold, so buffers can be sized up front.
+	size_t max_frame_len() const;
+
+	/** Write samples [\a begin, \a begin + \a samples) to \a out, as a FLAC
+	 * stream of their own.
+	 *
+	 * \param gain_stats	The final ReplayGain values, if already
+	 *	known; otherwise room is left to add them later
+	 * \param on_frame	Called with each frame of the track, decoded
+	 * \throw Copy_error
+	 * \throw Unix_error
+	 */
+	void copy(FILE *out, int64_t begin, int64_t samples,
+	    const Music_info &track, const Replaygain_stats *gain_stats,
+	    const std::function<void(const Frame &)> &on_frame);
+
+private:
+	Flac_copier(std::unique_ptr<Flac_copier_impl> &&);
+
+	std::unique_ptr<Flac_copier_impl>	_impl;
+};
+
+}
+
+#endif
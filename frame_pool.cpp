@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "frame_pool.hpp"
+
+flacsplit::Frame_pool::Frame_pool(size_t buffers, size_t len) :
+	_buffers(),
+	_free(),
+	_len(0),
+	_mutex(),
+	_cond()
+{
+	_buffers.reserve(buffers);
+	_free.reserve(buffers);
+	for (size_t i = 0; i < buffers; i++) {
+		_buffers.emplace_back(new Frame_ref::Buffer{
+		    .pool=this, .samples={}, .refs=0});
+		_free.push_back(_buffers.back().get());
+	}
+	reserve(len);
+}
+
+flacsplit::Frame_ref
+flacsplit::Frame_pool::acquire(size_t len, std::stop_token stop) {
+	Frame_ref::Buffer *buffer;
+	{
+		std::unique_lock lock(_mutex);
+		if (!_cond.wait(lock, stop, [this]() {
+			return !_free.empty();
+		}))
+			return Frame_ref();
+		buffer = _free.back();
+		_free.pop_back();
+		len = std::max(len, _len);
+	}
+
+	// the buffer is ours alone until it's shared
+	if (buffer->samples.size() < len)
+		buffer->samples.resize(len);
+	buffer->refs = 1;
+	return Frame_ref(buffer);
+}
+
+void
+flacsplit::Frame_pool::reserve(size_t len) {
+	std::lock_guard lock(_mutex);
+	if (len <= _len)
+		return;
+	_len = len;
+	// the rest are grown when they're next taken
+	for (Frame_ref::Buffer *buffer : _free)
+		if (buffer->samples.size() < len)
+			buffer->samples.resize(len);
+}
+
+void
+flacsplit::Frame_pool::release(Frame_ref::Buffer *buffer) noexcept {
+	{
+		std::lock_guard lock(_mutex);
+		// never reallocates, since it's reserved for every buffer
+		_free.push_back(buffer);
+	}
+	_cond.notify_all();
+}
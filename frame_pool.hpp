@@ -0,0 +1,115 @@
+#ifndef FLACSPLIT_FRAME_POOL_HPP
+#define FLACSPLIT_FRAME_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+namespace flacsplit {
+
+class Frame_pool;
+
+/** A counted reference to one of a Frame_pool's buffers. The buffer goes
+ * back to the pool once the last reference to it is gone; until then, the
+ * samples in it stay put, so whoever holds a reference may lag behind the
+ * thread that filled it without copying them.
+ */
+class Frame_ref {
+public:
+	Frame_ref() noexcept : _buffer(nullptr) {}
+
+	Frame_ref(const Frame_ref &rhs) noexcept : _buffer(rhs._buffer) {
+		if (_buffer)
+			_buffer->refs++;
+	}
+
+	Frame_ref(Frame_ref &&rhs) noexcept : _buffer(rhs._buffer) {
+		rhs._buffer = nullptr;
+	}
+
+	~Frame_ref() {
+		release();
+	}
+
+	Frame_ref &operator=(Frame_ref rhs) noexcept {
+		std::swap(_buffer, rhs._buffer);
+		return *this;
+	}
+
+	explicit operator bool() const noexcept {
+		return _buffer;
+	}
+
+	//! The samples; only whoever took the buffer from the pool should
+	//! write to them, before sharing it.
+	int32_t *samples() const noexcept {
+		return _buffer->samples.data();
+	}
+
+private:
+	friend class Frame_pool;
+
+	struct Buffer {
+		Frame_pool		*pool;
+		std::vector<int32_t>	samples;
+		std::atomic<unsigned>	refs;
+	};
+
+	explicit Frame_ref(Buffer *buffer) noexcept : _buffer(buffer) {}
+
+	void release() noexcept;
+
+	Buffer	*_buffer;
+};
+
+/** A fixed number of sample buffers, handed out as Frame_refs and reused
+ * once they're released. Buffers only grow, and can be sized up front from
+ * the stream, so that taking one doesn't allocate. The pool must outlive
+ * every reference to its buffers.
+ */
+class Frame_pool {
+public:
+	//! \param len	How many samples each buffer holds to begin with
+	explicit Frame_pool(size_t buffers, size_t len=0);
+
+	Frame_pool(const Frame_pool &) = delete;
+	void operator=(const Frame_pool &) = delete;
+
+	/** Wait for a free buffer, and make it hold at least \a len samples.
+	 *
+	 * \retval Frame_ref()	A stop was requested through \a stop first
+	 */
+	Frame_ref acquire(size_t len, std::stop_token stop);
+
+	//! Make every buffer hold at least \a len samples, once it's free.
+	void reserve(size_t len);
+
+private:
+	friend class Frame_ref;
+
+	void release(Frame_ref::Buffer *) noexcept;
+
+	std::vector<std::unique_ptr<Frame_ref::Buffer>>
+					_buffers;
+	std::vector<Frame_ref::Buffer *>
+					_free;
+	// what buffers are grown to as they're taken
+	size_t				_len;
+	std::mutex			_mutex;
+	std::condition_variable_any	_cond;
+};
+
+inline void
+Frame_ref::release() noexcept {
+	if (_buffer && !--_buffer->refs)
+		_buffer->pool->release(_buffer);
+	_buffer = nullptr;
+}
+
+}
+
+#endif
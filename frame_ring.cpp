@@ -0,0 +1,100 @@
+#include <algorithm>
+
+#include "frame_ring.hpp"
+
+flacsplit::Frame_ring::Frame_ring(size_t slots, Frame_pool &pool) :
+	_pool(pool),
+	_slots(slots),
+	_mutex(),
+	_cond(),
+	_head(0),
+	_count(0),
+	_closed(false),
+	_aborted(false),
+	_stop()
+{}
+
+bool
+flacsplit::Frame_ring::push(const Frame &frame, Frame_ref pin) {
+	Slot *slot;
+	{
+		std::unique_lock lock(_mutex);
+		_cond.wait(lock, [this]() {
+			return _aborted || _count < _slots.size();
+		});
+		if (_aborted)
+			return false;
+		slot = &_slots[(_head + _count) % _slots.size()];
+	}
+
+	// the slot is the producer's until it's counted, so copy unlocked
+	slot->channels.resize(frame.channels);
+	if (pin) {
+		std::copy(frame.data, frame.data + frame.channels,
+		    slot->channels.begin());
+		slot->pin = std::move(pin);
+	} else {
+		slot->pin = _pool.acquire(frame.samples * frame.channels,
+		    _stop.get_token());
+		if (!slot->pin)
+			return false;
+		for (int c = 0; c < frame.channels; c++) {
+			int32_t *dst = slot->pin.samples() +
+			    c * frame.samples;
+			std::copy(frame.data[c], frame.data[c] + frame.samples,
+			    dst);
+			slot->channels[c] = dst;
+		}
+	}
+	slot->frame = frame;
+	slot->frame.data = slot->channels.data();
+
+	{
+		std::lock_guard lock(_mutex);
+		_count++;
+	}
+	_cond.notify_all();
+	return true;
+}
+
+void
+flacsplit::Frame_ring::close() {
+	{
+		std::lock_guard lock(_mutex);
+		_closed = true;
+	}
+	_cond.notify_all();
+}
+
+const flacsplit::Frame *
+flacsplit::Frame_ring::front() {
+	std::unique_lock lock(_mutex);
+	_cond.wait(lock, [this]() {
+		return _aborted || _closed || _count;
+	});
+	if (_aborted || !_count)
+		return nullptr;
+	return &_slots[_head].frame;
+}
+
+void
+flacsplit::Frame_ring::pop() {
+	// back to the decoder or the pool
+	_slots[_head].pin = Frame_ref();
+	{
+		std::lock_guard lock(_mutex);
+		_head = (_head + 1) % _slots.size();
+		_count--;
+	}
+	_cond.notify_all();
+}
+
+void
+flacsplit::Frame_ring::abort() {
+	{
+		std::lock_guard lock(_mutex);
+		_aborted = true;
+	}
+	_cond.notify_all();
+	_stop.request_stop();
+}
@@ -0,0 +1,75 @@
+#ifndef FLACSPLIT_FRAME_RING_HPP
+#define FLACSPLIT_FRAME_RING_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+#include "frame_pool.hpp"
+#include "transcode.hpp"
+
+namespace flacsplit {
+
+/** A bounded queue of frames between one producer and one consumer
+ * thread. Frames are copied in, since a decoder's buffers only last until
+ * its next frame, unless they're pinned; the copies live in buffers from
+ * a pool, which may be shared with other rings and outlive this one.
+ */
+class Frame_ring {
+public:
+	/** \param slots	How many frames may be queued at once
+	 * \param pool	Where frames are copied to; it's best to have
+	 *	\a slots buffers for each ring sharing it
+	 */
+	Frame_ring(size_t slots, Frame_pool &pool);
+
+	Frame_ring(const Frame_ring &) = delete;
+	void operator=(const Frame_ring &) = delete;
+
+	/** Copy a frame in, waiting for a free slot. With \a pin, which
+	 * holds its samples, just the pointers are.
+	 *
+	 * \retval false	The consumer gave up; see abort()
+	 */
+	bool push(const Frame &, Frame_ref pin=Frame_ref());
+
+	/** No more frames will be pushed. */
+	void close();
+
+	/** Wait for the oldest frame.
+	 *
+	 * \retval nullptr	The ring is closed and empty, or was aborted
+	 */
+	const Frame *front();
+
+	/** Release the frame returned by front(). */
+	void pop();
+
+	/** Stop both ends: pending and future frames are dropped. */
+	void abort();
+
+private:
+	struct Slot {
+		Frame				frame;
+		std::vector<const int32_t *>	channels;
+		// holds the samples, whether pinned or copied
+		Frame_ref			pin;
+	};
+
+	Frame_pool		&_pool;
+	std::vector<Slot>	_slots;
+	std::mutex		_mutex;
+	std::condition_variable	_cond;
+	size_t			_head;
+	size_t			_count;
+	bool			_closed;
+	bool			_aborted;
+	// stops waiting for the pool, too
+	std::stop_source	_stop;
+};
+
+}
+
+#endif
@@ -0,0 +1,649 @@
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <new>
+
+#ifdef HAVE_LIBURING
+#	include <liburing.h>
+#endif
+
+#include "errors.hpp"
+#include "iofile.hpp"
+
+namespace {
+
+// what O_DIRECT transfers are aligned to; a page covers any device
+const size_t DIRECT_ALIGN = 4096;
+
+// how much Input_file reads just after a seek: a seek is often one of many,
+// e.g. libFLAC's bisection for a sample, each only reading a frame or two
+const size_t SEEK_READ_SIZE = 64 << 10;
+
+} // end anon
+
+namespace flacsplit {
+
+/** Reads and writes on a file that carry on while the caller does something
+ * else. They go through io_uring if flacsplit was built with it (make
+ * WITH_URING=1) and the kernel allows it; otherwise, each is done on the spot
+ * and wait() only collects its result, so callers needn't care which.
+ */
+class Async_io {
+public:
+	//! \param slots	How many requests can be in flight at once
+	Async_io(int fd, unsigned slots);
+
+	Async_io(const Async_io &) = delete;
+	void operator=(const Async_io &) = delete;
+
+	//! Waits for anything still in flight, since it points into buffers
+	//! that are about to be freed.
+	~Async_io();
+
+	//! Whether requests really are asynchronous.
+	bool async() const {
+#ifdef HAVE_LIBURING
+		return _ring_ok;
+#else
+		return false;
+#endif
+	}
+
+	//! Start a read into \a buf, to be collected by wait(\a slot). An
+	//! \a offset of -1 reads from the file's current offset, as from a
+	//! pipe; only one such read should be in flight at a time.
+	void read(unsigned slot, void *buf, size_t len, off_t offset) noexcept;
+
+	//! Start a write from \a buf, to be collected by wait(\a slot).
+	void write(unsigned slot, const void *buf, size_t len, off_t offset)
+	    noexcept;
+
+	/** Wait for the request in \a slot, if any.
+	 *
+	 * \return	The number of bytes transferred, which for a write is all
+	 *	of them; or -1, with errno set
+	 */
+	ssize_t wait(unsigned slot) noexcept;
+
+private:
+	struct Slot {
+		const uint8_t	*buf;
+		size_t		len;
+		off_t		offset;
+		ssize_t		result;
+		int		errnum;
+		bool		write;
+		bool		busy;
+	};
+
+	void start(unsigned slot) noexcept;
+	void finish(Slot &, ssize_t result, int errnum) noexcept;
+
+	std::vector<Slot>	_slots;
+	int			_fd;
+#ifdef HAVE_LIBURING
+	struct io_uring		_ring;
+	bool			_ring_ok;
+#endif
+};
+
+}
+
+flacsplit::Async_io::Async_io(int fd, unsigned slots) :
+	_slots(slots),
+	_fd(fd)
+{
+#ifdef HAVE_LIBURING
+	// fails where the kernel is too old or io_uring is locked down, and
+	// then everything is done on the spot
+	_ring_ok = !io_uring_queue_init(slots, &_ring, 0);
+#endif
+}
+
+flacsplit::Async_io::~Async_io() {
+	for (unsigned i = 0; i < _slots.size(); i++)
+		wait(i);
+#ifdef HAVE_LIBURING
+	if (_ring_ok)
+		io_uring_queue_exit(&_ring);
+#endif
+}
+
+void
+flacsplit::Async_io::read(unsigned slot, void *buf, size_t len,
+    off_t offset) noexcept {
+	_slots[slot] = Slot{static_cast<const uint8_t *>(buf), len, offset,
+	    0, 0, false, true};
+	start(slot);
+}
+
+void
+flacsplit::Async_io::write(unsigned slot, const void *buf, size_t len,
+    off_t offset) noexcept {
+	_slots[slot] = Slot{static_cast<const uint8_t *>(buf), len, offset,
+	    0, 0, true, true};
+	start(slot);
+}
+
+void
+flacsplit::Async_io::start(unsigned slot) noexcept {
+	Slot &s = _slots[slot];
+#ifdef HAVE_LIBURING
+	struct io_uring_sqe *sqe;
+	if (_ring_ok && (sqe = io_uring_get_sqe(&_ring))) {
+		if (s.write)
+			io_uring_prep_write(sqe, _fd, s.buf, s.len, s.offset);
+		else
+			io_uring_prep_read(sqe, _fd,
+			    const_cast<uint8_t *>(s.buf), s.len, s.offset);
+		io_uring_sqe_set_data(sqe, &s);
+		int n;
+		while ((n = io_uring_submit(&_ring)) == -EINTR)
+			;
+		if (n > 0)
+			return;
+		// it would go out with the next submit, and be done twice
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, nullptr);
+	}
+#endif
+	ssize_t n;
+	do {
+		if (s.write)
+			n = pwrite(_fd, s.buf, s.len, s.offset);
+		else if (s.offset < 0)
+			n = ::read(_fd, const_cast<uint8_t *>(s.buf), s.len);
+		else
+			n = pread(_fd, const_cast<uint8_t *>(s.buf), s.len,
+			    s.offset);
+	} while (n < 0 && errno == EINTR);
+	finish(s, n, n < 0 ? errno : 0);
+}
+
+void
+flacsplit::Async_io::finish(Slot &s, ssize_t result, int errnum) noexcept {
+	// a short write carries on from where it stopped
+	while (s.write && result >= 0 && static_cast<size_t>(result) < s.len) {
+		ssize_t n = pwrite(_fd, s.buf + result, s.len - result,
+		    s.offset + result);
+		if (n < 0 && errno != EINTR) {
+			result = -1;
+			errnum = errno;
+		} else if (!n) {
+			// no progress, and none to come from asking again
+			result = -1;
+			errnum = EIO;
+		} else if (n > 0)
+			result += n;
+	}
+	s.result = result;
+	s.errnum = errnum;
+	s.busy = false;
+}
+
+ssize_t
+flacsplit::Async_io::wait(unsigned slot) noexcept {
+	Slot &s = _slots[slot];
+#ifdef HAVE_LIBURING
+	while (s.busy) {
+		struct io_uring_cqe *cqe;
+		if (int err = io_uring_wait_cqe(&_ring, &cqe)) {
+			if (err == -EINTR)
+				continue;
+			// nothing is coming, so the requests are lost
+			for (Slot &lost : _slots)
+				if (lost.busy)
+					finish(lost, -1, -err);
+			break;
+		}
+		auto *done = static_cast<Slot *>(io_uring_cqe_get_data(cqe));
+		int res = cqe->res;
+		io_uring_cqe_seen(&_ring, cqe);
+		if (!done)
+			continue;
+		if (res < 0)
+			finish(*done, -1, -res);
+		else
+			finish(*done, res, 0);
+	}
+#endif
+	if (s.result < 0) {
+		errno = s.errnum;
+		return -1;
+	}
+	ssize_t result = s.result;
+	// wait() again is harmless
+	s.result = 0;
+	return result;
+}
+
+flacsplit::Output_file::Output_file(const std::filesystem::path &path,
+    const Output_options &options) :
+	_path(path),
+	_options(options),
+	_io(),
+	_bufs{nullptr, nullptr},
+	_buf(nullptr),
+	_cur(0),
+	_buf_len(0),
+	_buf_offset(0),
+	_end(0),
+	_allocated(0),
+	_fp(nullptr),
+	_fd(-1),
+	_direct(options.direct),
+	_errnum(0)
+{
+	// whole pages, so full buffers can be written directly
+	_options.buffer_size = std::max(_options.buffer_size, DIRECT_ALIGN);
+	_options.buffer_size += -_options.buffer_size % DIRECT_ALIGN;
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	if (_direct) {
+		_fd = ::open(path.c_str(), flags | O_DIRECT, 0666);
+		// not every filesystem can
+		if (_fd < 0 && errno == EINVAL)
+			_direct = false;
+	}
+	if (_fd < 0)
+		_fd = ::open(path.c_str(), flags, 0666);
+	if (_fd < 0) {
+		throw_traced(Unix_error(std::format(
+		    "open `{}' failed", path.c_str())));
+	}
+
+	for (uint8_t *&buf : _bufs) {
+		void *p;
+		if (int errnum = posix_memalign(&p, DIRECT_ALIGN,
+		    _options.buffer_size)) {
+			::close(_fd);
+			free(_bufs[0]);
+			throw_traced(Unix_error("posix_memalign failed",
+			    errnum));
+		}
+		buf = static_cast<uint8_t *>(p);
+	}
+	_buf = _bufs[0];
+
+	try {
+		_io.reset(new Async_io(_fd, 2));
+	} catch (const std::bad_alloc &) {
+		::close(_fd);
+		free(_bufs[0]);
+		free(_bufs[1]);
+		throw;
+	}
+
+	cookie_io_functions_t funcs;
+	funcs.read = nullptr;
+	funcs.write = write;
+	funcs.seek = seek;
+	funcs.close = nullptr;
+	if (!(_fp = fopencookie(this, "w", funcs))) {
+		int errnum = errno;
+		_io.reset();
+		::close(_fd);
+		free(_bufs[0]);
+		free(_bufs[1]);
+		throw_traced(Unix_error("fopencookie failed", errnum));
+	}
+	// the buffering is done here
+	setvbuf(_fp, nullptr, _IONBF, 0);
+}
+
+flacsplit::Output_file::~Output_file() {
+	if (_fd >= 0) {
+		try {
+			close();
+		} catch (...) {}
+	}
+	free(_bufs[0]);
+	free(_bufs[1]);
+}
+
+void
+flacsplit::Output_file::preallocate(off_t bytes) {
+	if (!_options.preallocate || bytes <= _allocated)
+		return;
+	// returns the error rather than setting errno
+	if (!posix_fallocate(_fd, 0, bytes))
+		_allocated = bytes;
+}
+
+void
+flacsplit::Output_file::close() {
+	if (_fd < 0)
+		return;
+	fclose(_fp);
+	_fp = nullptr;
+
+	int errnum = _errnum;
+	if (!errnum && !flush())
+		errnum = errno;
+	// even after an error, nothing can be left writing into a closed fd
+	if (!drain() && !errnum)
+		errnum = errno;
+	// preallocation made the file longer than it is
+	if (!errnum && _allocated > _end && ftruncate(_fd, _end))
+		errnum = errno;
+	if (!errnum && _options.drop_cache) {
+		// only clean pages can be dropped; it's only a hint, though
+		fdatasync(_fd);
+		posix_fadvise(_fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	if (::close(_fd) && !errnum)
+		errnum = errno;
+	_fd = -1;
+
+	if (errnum) {
+		throw_traced(Unix_error(std::format(
+		    "write `{}' failed", _path.c_str()), errnum));
+	}
+}
+
+bool
+flacsplit::Output_file::flush() noexcept {
+	if (!_buf_len)
+		return true;
+
+	if (_direct && (_buf_offset % DIRECT_ALIGN || _buf_len % DIRECT_ALIGN)) {
+		// O_DIRECT needs alignment; after the first write without it
+		// (the end of the file, or a seek back to patch the header),
+		// go through the page cache, once the writes in flight are done
+		if (!drain())
+			return false;
+		int flags = fcntl(_fd, F_GETFL);
+		if (flags == -1 || fcntl(_fd, F_SETFL, flags & ~O_DIRECT))
+			return false;
+		_direct = false;
+	}
+
+	_io->write(_cur, _buf, _buf_len, _buf_offset);
+	_buf_offset += _buf_len;
+	_buf_len = 0;
+	_end = std::max(_end, _buf_offset);
+
+	// fill the other buffer while this one is written
+	_cur ^= 1;
+	_buf = _bufs[_cur];
+	return _io->wait(_cur) >= 0;
+}
+
+bool
+flacsplit::Output_file::drain() noexcept {
+	bool ok = true;
+	int errnum = 0;
+	for (unsigned i = 0; i < 2; i++) {
+		if (_io->wait(i) < 0 && ok) {
+			ok = false;
+			errnum = errno;
+		}
+	}
+	if (!ok)
+		errno = errnum;
+	return ok;
+}
+
+ssize_t
+flacsplit::Output_file::write(void *cookie, const char *buf, size_t size) {
+	auto *self = reinterpret_cast<Output_file *>(cookie);
+	size_t left = size;
+	while (left) {
+		if (self->_buf_len == self->_options.buffer_size &&
+		    !self->flush()) {
+			self->_errnum = errno;
+			return -1;
+		}
+		size_t n = std::min(left,
+		    self->_options.buffer_size - self->_buf_len);
+		memcpy(self->_buf + self->_buf_len, buf, n);
+		self->_buf_len += n;
+		buf += n;
+		left -= n;
+	}
+	return size;
+}
+
+int
+flacsplit::Output_file::seek(void *cookie, off64_t *offset, int whence) {
+	auto *self = reinterpret_cast<Output_file *>(cookie);
+	off_t pos = self->_buf_offset + self->_buf_len;
+	off64_t base;
+	switch (whence) {
+	case SEEK_SET:	base = 0; break;
+	case SEEK_CUR:	base = pos; break;
+	case SEEK_END:	base = std::max(self->_end, pos); break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (*offset < -base) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	off_t target = base + *offset;
+	// ftell() lands here, too
+	if (target != pos) {
+		// writes in flight can land in any order, so patching what's
+		// already written waits for them
+		if (!self->flush() || (target < self->_end && !self->drain())) {
+			self->_errnum = errno;
+			return -1;
+		}
+		self->_buf_offset = target;
+	}
+	*offset = target;
+	return 0;
+}
+
+flacsplit::Input_file::Input_file(int fd, size_t buffer_size) :
+	_io(new Async_io(fd, 2)),
+	_bufs{
+		std::unique_ptr<uint8_t[]>(new uint8_t[buffer_size]),
+		std::unique_ptr<uint8_t[]>(new uint8_t[buffer_size]),
+	},
+	_buf_size(buffer_size),
+	_cur(0),
+	_buf_offset(0),
+	_buf_len(0),
+	_buf_pos(0),
+	_next_offset(0),
+	_ahead(false),
+	_seeked(false),
+	_size(-1)
+{
+	struct stat st;
+	if (fstat(fd, &st))
+		throw_traced(Unix_error("fstat failed"));
+	if (S_ISREG(st.st_mode))
+		_size = st.st_size;
+}
+
+flacsplit::Input_file::~Input_file() {
+	// before the buffers go
+	_io.reset();
+}
+
+ssize_t
+flacsplit::Input_file::read(void *buf, size_t len) noexcept {
+	auto *p = static_cast<uint8_t *>(buf);
+	size_t done = 0;
+	while (done < len) {
+		if (_buf_pos == _buf_len) {
+			if (!advance())
+				return done ? static_cast<ssize_t>(done) : -1;
+			if (!_buf_len)
+				break;
+		}
+		size_t n = std::min(len - done, _buf_len - _buf_pos);
+		memcpy(p + done, _bufs[_cur].get() + _buf_pos, n);
+		_buf_pos += n;
+		done += n;
+	}
+	return done;
+}
+
+bool
+flacsplit::Input_file::seek(off_t offset) noexcept {
+	if (offset < 0) {
+		errno = EINVAL;
+		return false;
+	}
+	if (offset >= _buf_offset &&
+	    offset <= _buf_offset + static_cast<off_t>(_buf_len)) {
+		_buf_pos = offset - _buf_offset;
+		return true;
+	}
+	if (stream()) {
+		if (offset < _buf_offset) {
+			errno = ESPIPE;
+			return false;
+		}
+		// skip there, read ahead and all
+		while (offset > _buf_offset + static_cast<off_t>(_buf_len)) {
+			_buf_pos = _buf_len;
+			if (!advance())
+				return false;
+			if (!_buf_len)
+				return true;
+		}
+		_buf_pos = offset - _buf_offset;
+		return true;
+	}
+	// the read ahead is still good if the seek was to where it starts
+	_buf_offset = offset;
+	_buf_len = 0;
+	_buf_pos = 0;
+	_seeked = true;
+	return true;
+}
+
+bool
+flacsplit::Input_file::advance() noexcept {
+	off_t offset = _buf_offset + _buf_len;
+	ssize_t n;
+	if (_ahead && _next_offset == offset) {
+		_cur ^= 1;
+		n = _io->wait(_cur);
+	} else {
+		// anything read ahead was for before a seek
+		if (_ahead)
+			_io->wait(_cur ^ 1);
+		size_t len = _seeked ? std::min(_buf_size, SEEK_READ_SIZE) :
+		    _buf_size;
+		_io->read(_cur, _bufs[_cur].get(), len,
+		    stream() ? -1 : offset);
+		n = _io->wait(_cur);
+	}
+	_ahead = false;
+	if (n < 0)
+		return false;
+	_buf_offset = offset;
+	_buf_len = n;
+	_buf_pos = 0;
+
+	// done on the spot, reading ahead would only make this read slower,
+	// and be wasted on a seek; just after a seek, it likely would be, too
+	bool seeked = _seeked;
+	_seeked = false;
+	if (n && _io->async() && !seeked) {
+		_next_offset = offset + n;
+		_io->read(_cur ^ 1, _bufs[_cur ^ 1].get(), _buf_size,
+		    stream() ? -1 : _next_offset);
+		_ahead = true;
+	}
+	return true;
+}
+
+flacsplit::Memory_file::Memory_file() :
+	_data(),
+	_pos(0),
+	_fp(nullptr)
+{
+	cookie_io_functions_t funcs;
+	funcs.read = read;
+	funcs.write = write;
+	funcs.seek = seek;
+	funcs.close = nullptr;
+	if (!(_fp = fopencookie(this, "w+", funcs)))
+		throw_traced(Unix_error("fopencookie failed"));
+}
+
+flacsplit::Memory_file::~Memory_file() {
+	fclose(_fp);
+}
+
+const std::vector<uint8_t> &
+flacsplit::Memory_file::data() {
+	fflush(_fp);
+	return _data;
+}
+
+void
+flacsplit::Memory_file::save(const std::filesystem::path &path,
+    const Output_options &options) {
+	const std::vector<uint8_t> &contents = data();
+
+	Output_file out(path, options);
+	out.preallocate(contents.size());
+	if (fwrite(contents.data(), 1, contents.size(), out.fp()) !=
+	    contents.size()) {
+		throw_traced(Unix_error(std::format(
+		    "write `{}' failed", path.c_str())));
+	}
+	out.close();
+}
+
+ssize_t
+flacsplit::Memory_file::read(void *cookie, char *buf, size_t size) {
+	auto *self = reinterpret_cast<Memory_file *>(cookie);
+	if (self->_pos >= self->_data.size())
+		return 0;
+	size = std::min(size, self->_data.size() - self->_pos);
+	memcpy(buf, self->_data.data() + self->_pos, size);
+	self->_pos += size;
+	return size;
+}
+
+ssize_t
+flacsplit::Memory_file::write(void *cookie, const char *buf, size_t size) {
+	auto *self = reinterpret_cast<Memory_file *>(cookie);
+	try {
+		// writing past the end leaves a hole of zeros, as with a file
+		if (self->_data.size() < self->_pos + size)
+			self->_data.resize(self->_pos + size);
+	} catch (const std::bad_alloc &) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(self->_data.data() + self->_pos, buf, size);
+	self->_pos += size;
+	return size;
+}
+
+int
+flacsplit::Memory_file::seek(void *cookie, off64_t *offset, int whence) {
+	auto *self = reinterpret_cast<Memory_file *>(cookie);
+	off64_t base;
+	switch (whence) {
+	case SEEK_SET:	base = 0; break;
+	case SEEK_CUR:	base = self->_pos; break;
+	case SEEK_END:	base = self->_data.size(); break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (*offset < -base) {
+		errno = EINVAL;
+		return -1;
+	}
+	self->_pos = base + *offset;
+	*offset = self->_pos;
+	return 0;
+}
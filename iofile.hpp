@@ -0,0 +1,195 @@
+#ifndef FLACSPLIT_IOFILE_HPP
+#define FLACSPLIT_IOFILE_HPP
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace flacsplit {
+
+class Async_io;
+
+//! How output files are written.
+struct Output_options {
+	//! How much is buffered between writes, in bytes; there are two such
+	//! buffers, one filling while the other is written
+	size_t	buffer_size = 1 << 20;
+	//! Reserve the estimated size of a file up front
+	bool	preallocate = false;
+	//! Don't leave a file in the page cache once it's written
+	bool	drop_cache = false;
+	//! Write around the page cache (O_DIRECT) where alignment allows
+	bool	direct = false;
+};
+
+/** A file being written through a large buffer of its own, rather than
+ * stdio's, but exposed as a stdio stream so that anything can write to it.
+ * It's written with as few system calls as the buffer allows, and with
+ * asynchronous I/O, a full buffer is written behind while the next fills.
+ */
+class Output_file {
+public:
+	//! \throw Unix_error
+	Output_file(const std::filesystem::path &path,
+	    const Output_options &options);
+
+	Output_file(const Output_file &) = delete;
+	void operator=(const Output_file &) = delete;
+
+	//! Closes the file if close() wasn't called, ignoring any error.
+	~Output_file();
+
+	//! Owned by the Output_file; don't fclose() it.
+	FILE *fp() const {
+		return _fp;
+	}
+
+	//! With Output_options::preallocate, reserve \a bytes on disk, so the
+	//! file isn't fragmented as it grows. It's only a hint; any of it
+	//! that isn't used is given back by close().
+	void preallocate(off_t bytes);
+
+	//! \throw Unix_error
+	void close();
+
+private:
+	static ssize_t	write(void *, const char *, size_t);
+	static int	seek(void *, off64_t *, int);
+
+	//! Start writing out the buffer, and switch to the other one once
+	//! it's free again; on failure, errno is set.
+	bool flush() noexcept;
+
+	//! Wait for every write in flight; on failure, errno is set.
+	bool drain() noexcept;
+
+	std::filesystem::path	_path;
+	Output_options		_options;
+	std::unique_ptr<Async_io>
+				_io;
+	// aligned, for O_DIRECT
+	uint8_t			*_bufs[2];
+	// the one being filled, _bufs[_cur]
+	uint8_t			*_buf;
+	unsigned		_cur;
+	size_t			_buf_len;
+	// where the buffered bytes go
+	off_t			_buf_offset;
+	// the length of the file, as written so far
+	off_t			_end;
+	off_t			_allocated;
+	FILE			*_fp;
+	int			_fd;
+	// whether O_DIRECT is (still) set
+	bool			_direct;
+	// set by write() if a flush failed
+	int			_errnum;
+};
+
+/** A file being read through a large buffer, with the next buffer's worth
+ * read ahead, while the caller works through this one, where asynchronous
+ * I/O is available. For libraries that take read callbacks rather than a
+ * file descriptor.
+ *
+ * Anything but a regular file (a pipe, say) is read as a stream: seeking
+ * forward reads up to the new offset, and seeking back only works within
+ * the buffer.
+ */
+class Input_file {
+public:
+	//! \param fd	Still the caller's to close, after the Input_file
+	//! \throw Unix_error
+	Input_file(int fd, size_t buffer_size=1 << 20);
+
+	Input_file(const Input_file &) = delete;
+	void operator=(const Input_file &) = delete;
+
+	//! Waits for any read ahead to finish.
+	~Input_file();
+
+	//! Like read(2): fewer than \a len bytes only at the end of the
+	//! file, and -1 with errno set on failure.
+	ssize_t read(void *buf, size_t len) noexcept;
+
+	//! Move where the next read() starts; on failure, errno is set. In a
+	//! stream, seeking past the end stops at the end.
+	bool seek(off_t offset) noexcept;
+
+	off_t tell() const {
+		return _buf_offset + _buf_pos;
+	}
+
+	//! The size of the file, or -1 if it isn't a regular file.
+	off_t size() const {
+		return _size;
+	}
+
+	bool stream() const {
+		return _size < 0;
+	}
+
+private:
+	//! Replace the buffer with what follows it; on failure, errno is set.
+	bool advance() noexcept;
+
+	std::unique_ptr<Async_io>	_io;
+	std::unique_ptr<uint8_t[]>	_bufs[2];
+	size_t				_buf_size;
+	// the one being read from, _bufs[_cur]
+	unsigned			_cur;
+	// where the buffer's contents came from
+	off_t				_buf_offset;
+	size_t				_buf_len;
+	size_t				_buf_pos;
+	// where the read into the other buffer, if _ahead, began
+	off_t				_next_offset;
+	bool				_ahead;
+	// whether the buffer is (or is about to be) the first after a seek
+	bool				_seeked;
+	off_t				_size;
+};
+
+/** A file that lives in memory, but that can be read, written, and seeked
+ * through stdio like any other. Used to hold an encoded track until its
+ * tags are final, so that it reaches the disk in a single write.
+ */
+class Memory_file {
+public:
+	//! \throw Unix_error
+	Memory_file();
+
+	Memory_file(const Memory_file &) = delete;
+	void operator=(const Memory_file &) = delete;
+
+	~Memory_file();
+
+	//! Owned by the Memory_file; don't fclose() it.
+	FILE *fp() const {
+		return _fp;
+	}
+
+	//! The contents, after flushing fp().
+	const std::vector<uint8_t> &data();
+
+	//! Write the contents out to \a path, replacing whatever was there.
+	//! \throw Unix_error
+	void save(const std::filesystem::path &path,
+	    const Output_options &options=Output_options());
+
+private:
+	static ssize_t	read(void *, char *, size_t);
+	static ssize_t	write(void *, const char *, size_t);
+	static int	seek(void *, off64_t *, int);
+
+	std::vector<uint8_t>	_data;
+	size_t			_pos;
+	FILE			*_fp;
+};
+
+}
+
+#endif
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 #include <ebur128.h>
 
@@ -7,6 +9,70 @@
 
 namespace flacsplit::replaygain {
 
+namespace {
+
+//! Interleaves planar samples as floats in [-1.0, 1.0).
+typedef void (*Interleaver)(const int32_t *const *in, float *out,
+    unsigned channels, size_t num_samples, int bits_per_sample);
+
+//! With the precision known at compile time, the scale is a constant
+//! multiplier and the inner loop vectorizes; with the channels known, too,
+//! rather than 0 for any, a sample's channels are unrolled and stored
+//! together.
+template <int Bits, unsigned Channels>
+void
+interleave_scaled(const int32_t *const *in, float *out, unsigned channels,
+    size_t num_samples, int) {
+	constexpr float scale = 1.0f / (UINT64_C(1) << (Bits - 1));
+	if constexpr (Channels) {
+		for (size_t i = 0; i < num_samples; i++)
+			for (unsigned c = 0; c < Channels; c++)
+				out[i * Channels + c] = in[c][i] * scale;
+	} else {
+		for (unsigned c = 0; c < channels; c++) {
+			const int32_t *src = in[c];
+			float *dst = out + c;
+			for (size_t i = 0; i < num_samples; i++)
+				dst[i * channels] = src[i] * scale;
+		}
+	}
+}
+
+// FLAC allows any precision from 4 to 32 bits
+void
+interleave_scaled_any(const int32_t *const *in, float *out,
+    unsigned channels, size_t num_samples, int bits_per_sample) {
+	float scale = 1.0f / (UINT64_C(1) << (bits_per_sample - 1));
+	for (size_t i = 0; i < num_samples; i++)
+		for (unsigned c = 0; c < channels; c++)
+			*out++ = in[c][i] * scale;
+}
+
+//! Mono, stereo and 5.1 get kernels of their own.
+template <int Bits>
+Interleaver
+interleaver_for(unsigned channels) {
+	switch (channels) {
+	case 1:  return interleave_scaled<Bits, 1>;
+	case 2:  return interleave_scaled<Bits, 2>;
+	case 6:  return interleave_scaled<Bits, 6>;
+	default: return interleave_scaled<Bits, 0>;
+	}
+}
+
+Interleaver
+interleaver(int bits_per_sample, unsigned channels) {
+	switch (bits_per_sample) {
+	case 8:  return interleave_scaled<8, 0>;
+	case 16: return interleaver_for<16>(channels);
+	case 24: return interleaver_for<24>(channels);
+	case 32: return interleaver_for<32>(channels);
+	default: return interleave_scaled_any;
+	}
+}
+
+} // end anon
+
 class Analyzer::Internal {
 public:
 	Internal(unsigned num_channels, unsigned long freq) {
@@ -18,13 +84,42 @@ public:
 			    "ebur128_init failed"
 			));
 		}
+		try {
+			set_channels(num_channels);
+		} catch (...) {
+			ebur128_destroy(&_state);
+			throw;
+		}
 	}
 
 	~Internal() {
 		ebur128_destroy(&_state);
 	}
 
-	ebur128_state *_state;
+	//! ebur128's default channel map already covers 5.1 in WAVE order;
+	//! only mono needs adjusting.
+	void set_channels(unsigned num_channels) {
+		_channels = num_channels;
+		// picked again by the next add()
+		_bits_per_sample = 0;
+		if (num_channels == 1) {
+			int err = ebur128_set_channel(
+			    _state, 0, EBUR128_DUAL_MONO
+			);
+			if (err)
+				flacsplit::throw_traced(Ebur128_error(err));
+		}
+	}
+
+	ebur128_state		*_state;
+	unsigned		_channels;
+	// what _interleave was picked for; a stream's precision is only
+	// known from its first frame
+	int			_bits_per_sample;
+	Interleaver		_interleave;
+	// interleaved samples for ebur128; kept between calls so that
+	// add() doesn't allocate once it's seen the largest frame
+	std::vector<float>	_scratch;
 };
 
 std::string
@@ -60,27 +155,32 @@ Analyzer::reset(unsigned num_channels, unsigned long freq) {
 	);
 	if (err)
 		flacsplit::throw_traced(Ebur128_error(err));
+	_internal->set_channels(num_channels);
 }
 
 void
-Analyzer::add(const double *left_samples, const double *right_samples,
-    size_t num_samples) {
-	if (!right_samples) {
-		int err = ebur128_add_frames_double(
-		    _internal->_state, left_samples, num_samples
-		);
-		if (err)
-			flacsplit::throw_traced(Ebur128_error(err));
+Analyzer::add(const int32_t *const *samples, size_t num_samples,
+    int bits_per_sample) {
+	unsigned channels = _internal->_channels;
+
+	auto &scratch = _internal->_scratch;
+	if (scratch.size() < num_samples * channels)
+		scratch.resize(num_samples * channels);
+
+	if (bits_per_sample != _internal->_bits_per_sample) {
+		_internal->_interleave = interleaver(bits_per_sample,
+		    channels);
+		_internal->_bits_per_sample = bits_per_sample;
 	}
-	// Samples need to be interleaved, sadly.
-	auto merged = std::make_unique<double[]>(num_samples * 2);
-	auto pos = merged.get();
-	for (size_t i = 0; i < num_samples; i++) {
-		*pos++ = *left_samples++;
-		*pos++ = *right_samples++;
-	}
-	int err = ebur128_add_frames_double(
-	    _internal->_state, merged.get(), num_samples
+
+	// Samples need to be interleaved, sadly. Floats are scaled here by a
+	// constant reciprocal; ebur128 would divide each int, and doubles
+	// would take twice the memory traffic.
+	_internal->_interleave(samples, scratch.data(), channels, num_samples,
+	    bits_per_sample);
+
+	int err = ebur128_add_frames_float(
+	    _internal->_state, scratch.data(), num_samples
 	);
 	if (err)
 		flacsplit::throw_traced(Ebur128_error(err));
@@ -97,13 +197,15 @@ Analyzer::gain() {
 
 double
 Analyzer::peak() {
-	double left, right;
-	int err;
-	if ((err = ebur128_true_peak(_internal->_state, 0, &left)))
-		flacsplit::throw_traced(Ebur128_error(err));
-	else if ((err = ebur128_true_peak(_internal->_state, 1, &right)))
-		flacsplit::throw_traced(Ebur128_error(err));
-	return std::max(left, right);
+	double result = 0.0;
+	for (unsigned c = 0; c < _internal->_channels; c++) {
+		double channel_peak;
+		int err = ebur128_true_peak(_internal->_state, c, &channel_peak);
+		if (err)
+			flacsplit::throw_traced(Ebur128_error(err));
+		result = std::max(result, channel_peak);
+	}
+	return result;
 }
 
 double
@@ -1,6 +1,7 @@
 #ifndef GAIN_ANALYSIS_HPP
 #define GAIN_ANALYSIS_HPP
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
@@ -36,7 +37,11 @@ class Analyzer {
 public:
 	/** Construct the analyzer object
 	 *
-	 * \param samplefreq	The input sample frequency
+	 * Mono is measured as if played on both speakers, and six channels
+	 * are taken to be 5.1 in WAVE order (L, R, C, LFE, Ls, Rs).
+	 *
+	 * \param num_channels	The number of channels
+	 * \param freq	The input sample frequency
 	 * \throw Ebur128_error
 	 */
 	Analyzer(unsigned num_channels, unsigned long freq);
@@ -60,15 +65,16 @@ public:
 
 	/** Accumulate samples into a calculation
 	 *
-	 * The range of the samples should be is [-32767.0,32767.0].
+	 * The samples are in [-2^(bits_per_sample-1), 2^(bits_per_sample-1)),
+	 * as decoded.
 	 *
-	 * \param left_samples	Samples for the left (or mono) channel
-	 * \param right_samples	Samples for the right channel; pass nullptr
-	 *	for single-channel
-	 * \param num_samples	Number of samples
+	 * \param samples	Planar samples, one array per channel
+	 * \param num_samples	Number of samples per channel
+	 * \param bits_per_sample	Precision of the samples
+	 * \throws	Ebur128_error
 	 */
-	void add(const double *left_samples, const double *right_samples,
-	    size_t num_samples);
+	void add(const int32_t *const *samples, size_t num_samples,
+	    int bits_per_sample);
 
 	/** Current calculation.
 	 *
@@ -0,0 +1,118 @@
+#include <cerrno>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "errors.hpp"
+#include "loudness_cache.hpp"
+
+// The cache is a text file:
+//
+//	flacsplit-loudness 1
+//	album <gain> <peak>
+//	track <size> <mtime_ns> <begin> <end> <gain> <peak> <source>
+//	...
+//
+// with a track line for each track, in order. Doubles are written in their
+// shortest form that reads back exactly.
+
+namespace {
+
+const char *const MAGIC = "flacsplit-loudness 1";
+
+} // end anon
+
+bool
+flacsplit::load_loudness(const std::filesystem::path &path,
+    const std::vector<Loudness_key> &keys, Replaygain_stats *gain_stats) {
+	std::ifstream in(path);
+	std::string line;
+	if (!std::getline(in, line) || line != MAGIC)
+		return false;
+
+	double album_gain;
+	double album_peak;
+	{
+		if (!std::getline(in, line))
+			return false;
+		std::istringstream fields(line);
+		std::string tag;
+		if (!(fields >> tag >> album_gain >> album_peak) ||
+		    tag != "album")
+			return false;
+	}
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (!std::getline(in, line))
+			return false;
+		std::istringstream fields(line);
+		std::string tag;
+		Loudness_key key;
+		double gain;
+		double peak;
+		if (!(fields >> tag >> key.size >> key.mtime_ns >> key.begin
+		    >> key.end >> gain >> peak) || tag != "track")
+			return false;
+		// the rest of the line, less the separating space
+		std::string source;
+		std::getline(fields, source);
+		if (source.empty())
+			return false;
+		key.source = source.substr(1);
+
+		const Loudness_key &want = keys[i];
+		if (key.source != want.source || key.size != want.size ||
+		    key.mtime_ns != want.mtime_ns ||
+		    key.begin != want.begin || key.end != want.end)
+			return false;
+
+		gain_stats[i].album_gain = album_gain;
+		gain_stats[i].album_peak = album_peak;
+		gain_stats[i].track_gain = gain;
+		gain_stats[i].track_peak = peak;
+	}
+
+	// a cache for more tracks than there are is for some other cue sheet
+	return !std::getline(in, line);
+}
+
+void
+flacsplit::save_loudness(const std::filesystem::path &path,
+    const std::vector<Loudness_key> &keys,
+    const Replaygain_stats *gain_stats) {
+	if (keys.empty())
+		return;
+
+	// write to the side and rename, so a reader never sees half a cache
+	std::filesystem::path tmp_path = path;
+	tmp_path += ".tmp";
+	{
+		std::ofstream out(tmp_path, std::ios::trunc);
+		out << MAGIC << '\n' << std::format("album {} {}\n",
+		    gain_stats[0].album_gain, gain_stats[0].album_peak);
+		for (size_t i = 0; i < keys.size(); i++) {
+			const Loudness_key &key = keys[i];
+			out << std::format("track {} {} {} {} {} {} {}\n",
+			    key.size, key.mtime_ns, key.begin, key.end,
+			    gain_stats[i].track_gain, gain_stats[i].track_peak,
+			    key.source.native());
+		}
+		out.close();
+		if (!out) {
+			std::error_code ignored;
+			std::filesystem::remove(tmp_path, ignored);
+			throw_traced(Unix_error(std::format(
+			    "write `{}' failed", tmp_path.c_str())));
+		}
+	}
+
+	if (rename(tmp_path.c_str(), path.c_str())) {
+		int errnum = errno;
+		std::error_code ignored;
+		std::filesystem::remove(tmp_path, ignored);
+		throw_traced(Unix_error(std::format(
+		    "rename to `{}' failed", path.c_str()), errnum));
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef FLACSPLIT_LOUDNESS_CACHE_HPP
+#define FLACSPLIT_LOUDNESS_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "replaygain_writer.hpp"
+
+namespace flacsplit {
+
+//! What a track's loudness depends on. If any of it changes, the cached
+//! measurement is stale.
+struct Loudness_key {
+	std::filesystem::path	source;
+	uint64_t		size;
+	int64_t			mtime_ns;
+	// CD frames; end is 0 for the rest of the file
+	int64_t			begin;
+	int64_t			end;
+};
+
+/** Look up an album's loudness in a cache file, as written by
+ * save_loudness().
+ *
+ * \param path	The cache file
+ * \param keys	One for each track
+ * \param[out] gain_stats	One for each track
+ * \retval false	The cache is missing, unreadable, or stale
+ */
+bool	load_loudness(const std::filesystem::path &path,
+	    const std::vector<Loudness_key> &keys,
+	    Replaygain_stats *gain_stats);
+
+/** Save an album's loudness for the next time it's split.
+ *
+ * \throw Unix_error
+ */
+void	save_loudness(const std::filesystem::path &path,
+	    const std::vector<Loudness_key> &keys,
+	    const Replaygain_stats *gain_stats);
+
+}
+
+#endif
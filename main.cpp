@@ -2,16 +2,22 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
-#include <cmath>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <thread>
 #include <vector>
 
 #include <boost/program_options/options_description.hpp>
@@ -24,9 +30,15 @@
 #include "decode.hpp"
 #include "encode.hpp"
 #include "errors.hpp"
+#include "flac_copy.hpp"
+#include "frame_ring.hpp"
+#include "iofile.hpp"
 #include "loudness.hpp"
+#include "loudness_cache.hpp"
 #include "replaygain_writer.hpp"
 #include "sanitize.hpp"
+#include "stats.hpp"
+#include "tar.hpp"
 #include "transcode.hpp"
 
 const char *prog;
@@ -88,16 +100,175 @@ private:
 	FILE *_fp;
 };
 
+// serializes console output from concurrent workers
+std::mutex	output_mutex;
+
+// where progress is reported; stdout, unless the archive goes there
+std::ostream	*progress = &std::cout;
+
+// libcuefile's parser keeps its state in globals
+std::mutex	cue_mutex;
+
+//! Holds one slot of the global thread budget for as long as it lives.
+class Budget_slot {
+public:
+	Budget_slot(std::counting_semaphore<> &budget) : _budget(budget) {
+		_budget.acquire();
+	}
+
+	Budget_slot(const Budget_slot &) = delete;
+	void operator=(const Budget_slot &) = delete;
+
+	~Budget_slot() {
+		_budget.release();
+	}
+
+private:
+	std::counting_semaphore<>	&_budget;
+};
+
+//! Claims up to some number of the threads that no album is using, for as
+//! long as it lives, so that concurrent albums don't each start a full
+//! --jobs of workers only to have most of them wait on the budget.
+class Thread_claim {
+public:
+	Thread_claim(std::atomic<unsigned> &spare, unsigned wanted) :
+		_spare(spare),
+		_count(0)
+	{
+		unsigned available = _spare.load();
+		do
+			_count = std::min(available, wanted);
+		while (!_spare.compare_exchange_weak(available,
+		    available - _count));
+	}
+
+	Thread_claim(const Thread_claim &) = delete;
+	void operator=(const Thread_claim &) = delete;
+
+	~Thread_claim() {
+		_spare += _count;
+	}
+
+	unsigned count() const {
+		return _count;
+	}
+
+private:
+	std::atomic<unsigned>	&_spare;
+	unsigned		_count;
+};
+
+// how many frames the loudness analyzer may lag behind the encoder
+const size_t ANALYSIS_RING_SLOTS = 8;
+
+//! Feeds a loudness analyzer from a thread of its own, so that analysis
+//! runs alongside encoding instead of taking turns with it.
+class Analysis_thread {
+public:
+	//! \param slots	How many frames the analyzer may fall behind
+	//! \param pool	Where frames that aren't pinned are copied to
+	//! \param stats	Where to time the analysis, if anywhere
+	Analysis_thread(replaygain::Analyzer &analyzer, size_t slots,
+	    Frame_pool &pool, Stage_stats *stats) :
+		_ring(slots, pool),
+		_error(),
+		_thread([this, &analyzer, stats]() { run(analyzer, stats); })
+	{}
+
+	Analysis_thread(const Analysis_thread &) = delete;
+	void operator=(const Analysis_thread &) = delete;
+
+	~Analysis_thread() {
+		if (_thread.joinable()) {
+			_ring.abort();
+			_thread.join();
+		}
+	}
+
+	//! \param pin	If the frame is pinned, to queue it without a copy
+	//! \throw flacsplit::replaygain::Ebur128_error
+	void add(const Frame &frame, Frame_ref pin) {
+		if (!_ring.push(frame, std::move(pin)))
+			// the analyzer failed; have finish() say why
+			finish();
+	}
+
+	//! Wait for the analyzer to catch up.
+	//! \throw flacsplit::replaygain::Ebur128_error
+	void finish() {
+		_ring.close();
+		_thread.join();
+		if (_error)
+			std::rethrow_exception(_error);
+	}
+
+private:
+	void run(replaygain::Analyzer &analyzer, Stage_stats *stats)
+	    noexcept {
+		try {
+			while (const Frame *frame = _ring.front()) {
+				Stage_timer timer(stats);
+				analyzer.add(frame->data, frame->samples,
+				    frame->bits_per_sample);
+				timer.stop(frame->samples);
+				_ring.pop();
+			}
+		} catch (...) {
+			_error = std::current_exception();
+			_ring.abort();
+		}
+	}
+
+	Frame_ring		_ring;
+	std::exception_ptr	_error;
+	std::thread		_thread;
+};
+
 struct options {
 	const std::filesystem::path	out_dir;
+	// shared by all albums; bounds the number of tracks being split
+	std::counting_semaphore<>	*budget;
+	bool	buffer;
+	bool	copy;
+	// frames to decode ahead on a thread of its own, if any
+	unsigned	decode_ahead;
+	Encode_options	encode;
 	bool	hidden_track;
+	// with --input, read instead of every FILE in the cue sheet
+	const std::filesystem::path	input;
+	unsigned	jobs;
+	Output_options	output;
+	bool	pipeline;
+	bool	prescan;
+	unsigned	read_frames;
+	// threads within --jobs that no album is running on; albums take
+	// them for their tracks
+	std::atomic<unsigned>	*spare_threads;
+	// with --stats, how to report them
+	std::optional<Stats_format>	stats;
 	bool	switch_index;
+	// with --tar, where the tracks go instead of files
+	Tar_writer	*tar;
 	bool	use_flac;
 };
 
+//! What tracks are split from: with --copy, a copier for a FLAC file whose
+//! frames can be copied, and otherwise a decoder. Only one is open.
+struct Track_source {
+	std::unique_ptr<Decoder>	decoder;
+	std::unique_ptr<Flac_copier>	copier;
+
+	explicit operator bool() const {
+		return decoder || copier;
+	}
+};
+
 template <typename In>
 void		create_dirs(In begin, In end, const std::filesystem::path &);
 std::string	escape_cue_string(const std::string &);
+double		estimate_duration(const std::filesystem::path &,
+		    bool use_flac) noexcept;
 std::pair<File_handle, std::filesystem::path>
 		find_file(const std::filesystem::path &, bool use_flac);
 std::tuple<std::string, std::string, int64_t>
@@ -106,7 +277,18 @@ std::pair<std::vector<std::filesystem::path>, std::filesystem::path>
 		make_album_path(const flacsplit::Music_info &album);
 std::string	make_track_name(const flacsplit::Music_info &track);
 bool		once(const std::filesystem::path &, const struct options *);
-void		transform_sample_fmt(const Frame &, double **);
+std::pair<File_handle, std::filesystem::path>
+		open_input(const std::filesystem::path &);
+Track_source	open_source(const std::filesystem::path &,
+		    const struct options *, int64_t last_track_frame,
+		    bool copy);
+Cd		*parse_cue(const std::filesystem::path &);
+template <typename F>
+bool		run_parallel(unsigned jobs, F work);
+bool		split_album(const std::filesystem::path &,
+		    const struct options *) noexcept;
+size_t		split_albums(const std::vector<std::string> &,
+		    const struct options *);
 void		usage(const boost::program_options::options_description &);
 
 class Cuetools_cd {
@@ -167,8 +349,9 @@ create_dirs(In begin, In end, const std::filesystem::path &out_dir) {
 		} else if (S_ISDIR(st.st_mode))
 			continue;
 
+		// another album by the same artist may be creating it too
 		mode_t mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-		if (mkdir(cur_dir.c_str(), mode) == -1) {
+		if (mkdir(cur_dir.c_str(), mode) == -1 && errno != EEXIST) {
 			throw_traced(flacsplit::Unix_error(std::format(
 			    "mkdir `{}' failed", cur_dir.c_str())));
 		}
@@ -226,6 +409,45 @@ find_file(const std::filesystem::path &src_path, bool use_flac) {
 	return std::make_pair(File_handle{}, src_path);
 }
 
+//! Estimated playing time of an album in seconds, used to schedule the
+//! longest albums first. Any error yields 0 and is left for once() to
+//! report.
+double
+estimate_duration(const std::filesystem::path &cue_path, bool use_flac)
+    noexcept {
+	try {
+		Cuetools_cd cd = parse_cue(cue_path);
+		if (!cd)
+			return 0;
+
+		std::vector<std::filesystem::path> src_paths;
+		unsigned tracks = cd_get_ntrack(cd);
+		for (unsigned i = 0; i < tracks; i++) {
+			auto src_path = cue_path.parent_path() /
+			    track_get_filename(cd_get_track(cd, i+1));
+			if (std::find(src_paths.begin(), src_paths.end(),
+			    src_path) == src_paths.end())
+				src_paths.push_back(src_path);
+		}
+
+		double seconds = 0;
+		for (auto &src_path : src_paths) {
+			auto [in_file, derived_path] = find_file(
+			    src_path, use_flac
+			);
+			if (!in_file)
+				continue;
+			Decoder decoder(in_file);
+			in_file.release();
+			seconds += static_cast<double>(
+			    decoder.total_samples()) / decoder.sample_rate();
+		}
+		return seconds;
+	} catch (...) {
+		return 0;
+	}
+}
+
 #if 0
 std::string
 frametime(int64_t frames) {
@@ -322,16 +544,471 @@ struct track_offset {
 	unsigned track_number;
 };
 
+//! The file given with --input, standing in for the cue sheet's FILE; `-'
+//! is standard input.
+std::pair<File_handle, std::filesystem::path>
+open_input(const std::filesystem::path &path) {
+	if (path != "-")
+		return std::make_pair(File_handle(fopen(path.c_str(), "rb")),
+		    path);
+
+	// the decoder closes what it's given
+	FILE *fp = nullptr;
+	int fd = dup(STDIN_FILENO);
+	if (fd >= 0 && !(fp = fdopen(fd, "rb"))) {
+		int errnum = errno;
+		close(fd);
+		errno = errnum;
+	}
+	return std::make_pair(File_handle(fp),
+	    std::filesystem::path("standard input"));
+}
+
+//! Open the audio file behind a cue sheet FILE entry, or --input, and check
+//! that it's long enough. With \a copy, it's opened for copying, if it can
+//! be. Failures to open are reported and yield an empty source.
+//! \throw flacsplit::Not_enough_samples
+//! \throw flacsplit::Flac_copier::Copy_error
+Track_source
+open_source(const std::filesystem::path &src_path,
+    const struct options *options, int64_t last_track_frame, bool copy) {
+	auto [in_file, derived_path] = options->input.empty() ?
+	    find_file(src_path, options->use_flac) :
+	    open_input(options->input);
+	if (!in_file) {
+		int errnum = errno;
+		std::lock_guard lock(output_mutex);
+		std::cerr << prog << ": open " << derived_path
+		    << " failed: " << strerror(errnum) << '\n';
+		return {};
+	}
+
+	{
+		std::lock_guard lock(output_mutex);
+		*progress << "< " << derived_path.c_str() << '\n';
+	}
+
+	Track_source source;
+	int32_t sample_rate;
+	int64_t total_samples;
+	// anything that can't be copied is transcoded
+	if (copy)
+		source.copier = Flac_copier::open(in_file, options->encode);
+	if (source.copier) {
+		sample_rate = source.copier->sample_rate();
+		total_samples = source.copier->total_samples();
+	} else {
+		try {
+			source.decoder.reset(new Decoder(in_file,
+			    file_format::UNKNOWN, options->read_frames,
+			    options->decode_ahead));
+			in_file.release();
+		} catch (const Bad_format &) {
+			{
+				std::lock_guard lock(output_mutex);
+				std::cerr << prog << ": unknown format in file `"
+				    << derived_path << "'\n";
+			}
+			in_file.close();
+			return {};
+		}
+		sample_rate = source.decoder->sample_rate();
+		total_samples = source.decoder->total_samples();
+	}
+
+	double last_track_sample = last_track_frame * sample_rate / 75.;
+	if (total_samples <= last_track_sample) {
+		throw_traced(Not_enough_samples(std::format(
+		    "file `{}' does not contain enough samples"
+		    "; expected at least {} but found {}",
+		    derived_path.c_str(),
+		    last_track_sample,
+		    total_samples)));
+	}
+	return source;
+}
+
+//! Call \a work from \a jobs threads at once, this one among them, and wait
+//! for all of them. The first exception thrown by any of them is rethrown.
+template <typename F>
+bool
+run_parallel(unsigned jobs, F work) {
+	if (jobs <= 1)
+		return work();
+
+	std::mutex		mutex;
+	std::exception_ptr	error;
+	bool			ok = true;
+
+	auto run = [&]() {
+		bool result = false;
+		std::exception_ptr e;
+		try {
+			result = work();
+		} catch (...) {
+			e = std::current_exception();
+		}
+
+		std::lock_guard lock(mutex);
+		ok = ok && result;
+		if (e && !error)
+			error = e;
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < jobs; i++)
+		threads.emplace_back(run);
+	run();
+	for (auto &thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+	return ok;
+}
+
+//! Call \a work(source, i) for each track \a i, from up to options->jobs
+//! threads at once. Each thread claims the next unclaimed track and keeps
+//! its source open from one track to the next; tracks are independent of
+//! one another, so the result is the same regardless of how many threads
+//! there are. With \a copy, FLAC sources are opened for copying rather
+//! than decoding. Failures to open a source are reported and yield false,
+//! as does \a work returning false.
+template <typename F>
+bool
+for_each_track(const std::vector<std::filesystem::path> &src_paths,
+    const struct options *options, int64_t last_track_frame, bool copy,
+    F work) {
+	std::atomic<size_t> next_track = 0;
+	auto worker = [&]() -> bool {
+		std::filesystem::path src_path;
+		Track_source source;
+		try {
+			size_t i;
+			while ((i = next_track++) < src_paths.size()) {
+				Budget_slot slot(*options->budget);
+
+				if (!source || src_paths[i] != src_path) {
+					// switch file
+					src_path = src_paths[i];
+					source = open_source(src_path, options,
+					    last_track_frame, copy);
+					if (!source) {
+						next_track = src_paths.size();
+						return false;
+					}
+				}
+
+				if (!work(source, i)) {
+					next_track = src_paths.size();
+					return false;
+				}
+			}
+		} catch (...) {
+			// stop the other workers
+			next_track = src_paths.size();
+			throw;
+		}
+		return true;
+	};
+
+	// the album's own thread is one worker; any more come out of what
+	// the other albums leave spare
+	unsigned jobs = std::min<size_t>(options->jobs, src_paths.size());
+	Thread_claim extra(*options->spare_threads, jobs ? jobs - 1 : 0);
+	return run_parallel(extra.count() + 1, worker);
+}
+
+//! Fill in \a gain_stats, one for each track, from the tracks' analyzers.
+//! \throw flacsplit::Not_enough_samples
+void
+compute_gain(std::vector<std::optional<replaygain::Analyzer>> &track_analyzers,
+    const std::vector<track_offset> &offsets, Replaygain_stats *gain_stats) {
+	std::vector<replaygain::Analyzer> rg_analyzers;
+	rg_analyzers.reserve(track_analyzers.size());
+	for (size_t i = 0; i < track_analyzers.size(); i++) {
+		// an analyzer starts with the track's first frame
+		if (!track_analyzers[i])
+			throw_traced(Not_enough_samples(std::format(
+			    "no samples to measure for track {}",
+			    offsets[i].track_number)));
+		rg_analyzers.push_back(std::move(*track_analyzers[i]));
+	}
+
+	double album_gain = replaygain::Analyzer::gain_multiple(rg_analyzers);
+	double album_peak = replaygain::Analyzer::peak_multiple(rg_analyzers);
+
+	for (size_t i = 0; i < rg_analyzers.size(); i++) {
+		gain_stats[i].album_gain = album_gain;
+		gain_stats[i].album_peak = album_peak;
+		gain_stats[i].track_gain = rg_analyzers[i].gain();
+		gain_stats[i].track_peak = rg_analyzers[i].peak();
+	}
+}
+
+//! What each track's loudness depends on, for caching it. Empty if any
+//! source can't be found; that's for decoding to report.
+std::vector<Loudness_key>
+loudness_keys(const std::vector<std::filesystem::path> &src_paths,
+    const std::vector<track_offset> &offsets, bool use_flac) {
+	std::vector<Loudness_key> keys;
+	for (size_t i = 0; i < src_paths.size(); i++) {
+		Loudness_key key;
+		if (i && src_paths[i] == src_paths[i-1]) {
+			key = keys.back();
+		} else {
+			auto [in_file, derived_path] = find_file(src_paths[i],
+			    use_flac);
+			struct stat st;
+			if (!in_file || fstat(fileno(in_file), &st))
+				return {};
+			key.source = derived_path;
+			key.size = st.st_size;
+			key.mtime_ns = st.st_mtim.tv_sec * INT64_C(1000000000) +
+			    st.st_mtim.tv_nsec;
+		}
+		key.begin = offsets[i].begin;
+		key.end = offsets[i].end;
+		keys.push_back(key);
+	}
+	return keys;
+}
+
+//! How many samples long a track is, in a stream of \a total_samples.
+int64_t
+track_length(const track_offset &offset, int32_t sample_rate,
+    int64_t total_samples) {
+	double		samples;
+	if (offset.end) {
+		int64_t frames = offset.end - offset.begin;
+		samples = frames * sample_rate / 75.;
+	} else {
+		double begin_sample = offset.begin * sample_rate / 75.;
+		if (total_samples <= begin_sample) {
+			throw_traced(std::runtime_error(
+			    "beginning offset isn't where it was expected"
+			));
+		}
+		samples = total_samples - begin_sample;
+	}
+	return static_cast<int64_t>(samples + .5);
+}
+
+//! Decode a single track, passing each of its frames to \a on_frame. The
+//! first frame is passed along with the track length, in samples.
+//! \param stats	Where to time decoding, if anywhere
+//! \retval false	There were no samples to decode
+template <typename F>
+bool
+decode_track(Decoder &decoder, const track_offset &offset,
+    Split_stats *stats, F on_frame) {
+	// the stream properties are known once the decoder is open; FLAC's
+	// come from its STREAMINFO, which is read before the first frame
+	int64_t track_samples = track_length(offset, decoder.sample_rate(),
+	    decoder.total_samples());
+
+	// if this track starts where the decoder's last one ended, the seek
+	// is a no-op and the rest of the boundary frame is used
+	int64_t samples = 0;
+	decoder.seek_frame(offset.begin);
+	do {
+		bool allow_short = offset.end == 0;
+		Stage_timer timer(stats ? &(*stats)[Stage::DECODE] : nullptr);
+		Frame frame = decoder.next_frame(allow_short,
+		    track_samples - samples);
+		timer.stop(frame.samples, frame.samples * frame.channels *
+		    ((frame.bits_per_sample + 7) / 8));
+		if (allow_short && !frame.samples)
+			break;
+
+		on_frame(frame, track_samples);
+		samples += frame.samples;
+	} while (samples < track_samples);
+
+	return samples != 0;
+}
+
+//! Measure the loudness of a single track into \a rg_analyzer, without
+//! encoding it.
+void
+measure_track(Decoder &decoder, const track_offset &offset,
+    std::optional<replaygain::Analyzer> &rg_analyzer, Split_stats *stats) {
+	bool any = decode_track(decoder, offset, stats,
+	    [&](const Frame &frame, int64_t) {
+		Stage_timer timer(stats ? &(*stats)[Stage::ANALYZE] :
+		    nullptr);
+		if (!rg_analyzer)
+			rg_analyzer.emplace(frame.channels,
+			    decoder.sample_rate());
+		rg_analyzer->add(frame.data, frame.samples,
+		    frame.bits_per_sample);
+		timer.stop(frame.samples);
+	});
+	if (!any)
+		throw_traced(Not_enough_samples(std::format(
+		    "no samples for track {}", offset.track_number)));
+}
+
+//! Transcode a single track into \a out_name. Either its loudness is
+//! measured into \a rg_analyzer on the way, to be tagged later, or it's
+//! already known and \a gain_stats is tagged now. If \a source is a copier,
+//! the track's FLAC frames are copied from it instead. With --pipeline, the
+//! frames queued for analysis are copied into \a analysis_pool, unless the
+//! decoder pins them. With \a stats, the stages are timed.
+//! \throw flacsplit::Unix_error
+bool
+split_track(Track_source &source, const track_offset &offset,
+    const Music_info &track_info, const std::filesystem::path &out_name,
+    const struct options *options, Memory_file *buffer,
+    std::optional<replaygain::Analyzer> *rg_analyzer,
+    const Replaygain_stats *gain_stats, Frame_pool &analysis_pool,
+    Split_stats *stats) {
+	auto stage = [stats](Stage stage) {
+		return stats ? &(*stats)[stage] : nullptr;
+	};
+
+	{
+		std::lock_guard lock(output_mutex);
+		*progress << "> " << out_name.c_str() << '\n';
+	}
+
+	// with --buffer, the track is kept in memory until it's tagged
+	std::optional<Output_file> out;
+	FILE *out_file;
+	if (buffer)
+		out_file = buffer->fp();
+	else {
+		out.emplace(out_name, options->output);
+		out_file = out->fp();
+	}
+
+	// the encoder's threads besides this one, out of what the tracks
+	// being split leave spare; before the encoder, so they're given back
+	// once it's done with them
+	std::optional<Thread_claim> encoder_threads;
+	std::shared_ptr<Encoder> encoder;
+	// with --pipeline; after the encoder, so it's stopped first
+	std::optional<Analysis_thread> analysis;
+
+	// a pinned frame is queued for analysis without a copy
+	auto measure = [&](const Frame &frame, Frame_ref pin=Frame_ref()) {
+		if (!rg_analyzer)
+			return;
+		if (!*rg_analyzer) {
+			rg_analyzer->emplace(frame.channels, frame.rate);
+			if (options->pipeline) {
+				// a no-op after the album's first track
+				analysis_pool.reserve(source.copier ?
+				    source.copier->max_frame_len() :
+				    source.decoder->max_frame_len());
+				analysis.emplace(**rg_analyzer,
+				    ANALYSIS_RING_SLOTS, analysis_pool,
+				    stage(Stage::ANALYZE));
+			}
+		}
+
+		if (analysis)
+			analysis->add(frame, std::move(pin));
+		else {
+			Stage_timer timer(stage(Stage::ANALYZE));
+			(*rg_analyzer)->add(
+			    frame.data, frame.samples, frame.bits_per_sample
+			);
+			timer.stop(frame.samples);
+		}
+	};
+
+	if (Flac_copier *copier = source.copier.get()) {
+		int64_t begin = frame_sample(copier->sample_rate(),
+		    offset.begin);
+		int64_t track_samples = track_length(offset,
+		    copier->sample_rate(), copier->total_samples());
+		// analysis happens within, and is counted in both
+		Stage_timer timer(stage(Stage::ENCODE));
+		copier->copy(out_file, begin, track_samples, track_info,
+		    gain_stats, measure);
+		timer.stop(track_samples, ftello(out_file));
+	} else {
+		// transcode
+		Decoder &decoder = *source.decoder;
+		decode_track(decoder, offset, stats,
+		    [&](const Frame &frame, int64_t track_samples) {
+			if (!encoder) {
+				Encode_options encode = options->encode;
+				encoder_threads.emplace(
+				    *options->spare_threads,
+				    encode.threads - 1);
+				encode.threads = encoder_threads->count() + 1;
+				encoder.reset(new Encoder(
+				    out_file,
+				    track_info,
+				    track_samples,
+				    frame.rate,
+				    gain_stats,
+				    encode
+				));
+
+				// CD audio tends to compress to about 60%
+				// of its PCM size, but loud or noisy masters
+				// do worse; 3/4 covers most of them. Too
+				// much costs nothing, since close() trims it,
+				// while too little leaves the tail to be
+				// allocated as it's written, fragmented
+				if (out)
+					out->preallocate(track_samples *
+					    frame.channels *
+					    ((frame.bits_per_sample + 7) / 8) *
+					    3 / 4);
+			}
+
+			measure(frame, decoder.pin());
+			Stage_timer timer(stage(Stage::ENCODE));
+			encoder->add_frame(frame);
+			timer.stop(frame.samples);
+		});
+
+		if (!encoder)
+			throw_traced(Not_enough_samples(std::format(
+			    "no samples for `{}'", out_name.c_str())));
+	}
+
+	if (analysis)
+		analysis->finish();
+
+	if (encoder) {
+		Stage_timer timer(stage(Stage::ENCODE));
+		if (!encoder->finish()) {
+			std::lock_guard lock(output_mutex);
+			std::cerr << prog << ": finish() failed\n";
+			return false;
+		}
+		// finish() leaves the file where it rewrote STREAMINFO
+		fseeko(out_file, 0, SEEK_END);
+		timer.stop(0, ftello(out_file));
+	}
+	if (out) {
+		Stage_timer timer(stage(Stage::WRITE));
+		out->close();
+	}
+	return true;
+}
+
+
 bool
 once(const std::filesystem::path &cue_path, const struct options *options) {
 	using namespace flacsplit;
 
+	// with --stats; the tracks' stages are added up later
+	Stage_stats total;
+	Stage_timer total_timer(options->stats ? &total : nullptr);
+	Split_stats album_stats;
+
 	auto cue_dir = cue_path.parent_path();
 	auto [genre, date, offset] = get_cue_extra(cue_path);
 
-	int fmt = CUE;
-	Cuetools_cd cd = cf_parse(const_cast<char *>(cue_path.c_str()), &fmt);
+	Cuetools_cd cd = parse_cue(cue_path);
 	if (!cd) {
+		std::lock_guard lock(output_mutex);
 		std::cerr << prog << ": parse failed\n";
 		return false;
 	}
@@ -395,209 +1072,279 @@ once(const std::filesystem::path &cue_path, const struct options *options) {
 		}
 
 	auto [dir_components, dir_path] = make_album_path(album_info);
-	create_dirs(dir_components.begin(), dir_components.end(),
-	    options->out_dir);
+	if (!options->tar) {
+		Stage_timer timer(options->stats ?
+		    &album_stats[Stage::MKDIR] : nullptr);
+		create_dirs(dir_components.begin(), dir_components.end(),
+		    options->out_dir);
+	}
 
 	// construct base of output pathnames
 	if (!options->out_dir.empty())
 		dir_path = options->out_dir / dir_path;
 
-	std::filesystem::path src_path;
-	std::unique_ptr<Decoder> decoder;
+	// resolve each track's source and output paths up front, so workers
+	// don't have to touch the cue sheet
+	std::vector<std::filesystem::path> src_paths;
 	std::vector<std::filesystem::path> out_paths;
-
-	// for replaygain analysis
-	std::vector<replaygain::Analyzer>	rg_analyzers;
-	std::unique_ptr<double[]>		rg_samples;
-	double	*double_samples[] = { nullptr, nullptr };
-	int	dimens[] = { 0, 0 };
-
-	std::unique_ptr<Replaygain_stats[]> gain_stats(
-	    new Replaygain_stats[offsets.size()]);
-
 	for (size_t i = 0; i < offsets.size(); i++) {
-		auto offset = offsets[i];
-
-		unsigned track_number = offset.track_number;
+		unsigned track_number = offsets[i].track_number;
 		Track *track = track_number ? cd_get_track(cd, track_number) :
 		    cd_get_track(cd, 1);
-		std::filesystem::path cur_path = cue_dir;
-		cur_path /= track_get_filename(track);
-
-		if (!decoder || cur_path != src_path) {
-			// switch file
-
-			src_path = cur_path;
-			auto [in_file, derived_path] = find_file(
-			    src_path, options->use_flac
-			);
-			if (!in_file) {
-				std::cerr << prog << ": open "
-				    << derived_path
-				    << " failed: " << strerror(errno)
-				    << '\n';
-				return false;
-			}
-
-			std::cout << "< " << derived_path.c_str() << '\n';
-
-			try {
-				decoder.reset(new Decoder(in_file));
-				in_file.release();
-			} catch (const Bad_format &) {
-				std::cerr << prog
-				    << ": unknown format in file `"
-				    << derived_path << "'\n";
-				in_file.close();
-				return false;
-			}
-
-			int64_t last_track_frame =
-			    offsets[offsets.size()-1].begin;
-			double last_track_sample = last_track_frame *
-			    decoder->sample_rate() / 75.;
-			if (decoder->total_samples() <= last_track_sample) {
-				throw_traced(Not_enough_samples(std::format(
-				    "file `{}' does not contain enough samples"
-				    "; expected at least {} but found {}",
-				    derived_path.c_str(),
-				    last_track_sample,
-				    decoder->total_samples())));
-			}
-		}
+		src_paths.push_back(cue_dir / track_get_filename(track));
 
 		std::filesystem::path out_name = dir_path;
 		out_name /= make_track_name(*track_info[i]);
 		out_name += ".flac";
 		out_paths.push_back(out_name);
+	}
 
-		std::cout << "> " << out_name.c_str() << '\n';
-
-		File_handle out_file;
-		if (!(out_file = fopen(out_name.c_str(), "wb"))) {
-			throw_traced(Unix_error(std::format(
-			    "open `{}' failed", out_name.c_str())));
+	if (!options->input.empty()) {
+		// it's read once, front to back
+		for (size_t i = 1; i < offsets.size(); i++) {
+			if (src_paths[i] != src_paths[0])
+				throw_traced(std::runtime_error(
+				    "--input can only stand in for one FILE"
+				));
+			if (offsets[i].begin < offsets[i-1].begin)
+				throw_traced(std::runtime_error(
+				    "--input needs tracks in order"
+				));
 		}
+	}
 
-		std::shared_ptr<Encoder> encoder;
+	int64_t last_track_frame = offsets[offsets.size()-1].begin;
 
-		// transcode
-		int64_t samples = 0;
-		int64_t track_samples = 0;
-		decoder->seek_frame(offset.begin);
-		do {
-			bool allow_short = offset.end == 0;
-			Frame frame = decoder->next_frame(allow_short);
-			if (allow_short && !frame.samples)
-				break;
-
-			// with FLAC, stream properties like the sample rate
-			// aren't known until after the first seek/process
-			if (!track_samples) {
-				double		samples;
-				if (offset.end) {
-					int64_t frames = offset.end - offset.begin;
-					samples = frames *
-					    decoder->sample_rate() / 75.;
-				} else {
-					double begin_sample = offset.begin *
-					    decoder->sample_rate() / 75.;
-					if (decoder->total_samples() <=
-					    begin_sample) {
-						throw_traced(std::runtime_error(
-						    "beginning offset isn't "
-						    "where it was expected"
-						));
-					}
-					samples = decoder->total_samples() -
-					    begin_sample;
-				}
-				track_samples = static_cast<int64_t>(
-				    samples + .5);
+	// with --pipeline, what the tracks' analysis rings copy frames into;
+	// a ring's worth for each track being split at once, reused from one
+	// track to the next
+	Frame_pool analysis_pool(options->pipeline ? ANALYSIS_RING_SLOTS *
+	    std::min<size_t>(options->jobs, offsets.size()) : 0);
 
-				encoder.reset(new Encoder(
-				    out_file,
-				    *track_info[i],
-				    track_samples,
-				    frame.rate
-				));
+	std::vector<Split_stats> track_stats(offsets.size());
+	auto stats_for = [&](size_t i) {
+		return options->stats ? &track_stats[i] : nullptr;
+	};
+	auto report = [&]() {
+		if (!options->stats)
+			return;
+		total_timer.stop();
+		std::vector<std::string> names;
+		for (auto &out_path : out_paths)
+			names.push_back(out_path.filename().string());
+		std::lock_guard lock(output_mutex);
+		write_stats(*progress, *options->stats, dir_path.string(),
+		    names, track_stats, album_stats, total);
+	};
 
-				rg_analyzers.emplace_back(2, decoder->sample_rate());
-			}
+	// for replaygain analysis
+	std::vector<std::optional<replaygain::Analyzer>> track_analyzers(
+	    offsets.size());
+
+	std::unique_ptr<Replaygain_stats[]> gain_stats(
+	    new Replaygain_stats[offsets.size()]);
+
+	// with --prescan, loudness is known before anything is encoded,
+	// either from the last time or from a pass of its own, and the tracks
+	// are tagged as they're written
+	bool measured = false;
+	if (options->prescan) {
+		std::filesystem::path cache_path = cue_path;
+		cache_path += ".loudness";
+		std::vector<Loudness_key> cache_keys = loudness_keys(
+		    src_paths, offsets, options->use_flac);
+
+		measured = !cache_keys.empty() && load_loudness(cache_path,
+		    cache_keys, gain_stats.get());
+		if (!measured) {
+			if (!for_each_track(src_paths, options,
+			    last_track_frame, false,
+			    [&](Track_source &source, size_t i) {
+				measure_track(*source.decoder, offsets[i],
+				    track_analyzers[i], stats_for(i));
+				return true;
+			}))
+				return false;
+			compute_gain(track_analyzers, offsets, gain_stats.get());
+			measured = true;
 
-			int64_t remaining = track_samples - samples;
-			if (remaining < frame.samples)
-				frame.samples = remaining;
-			samples += frame.samples;
-
-			if (frame.samples > dimens[0] ||
-			    frame.channels > dimens[1]) {
-				// reset the buffer for conversion to double
-				dimens[0] = frame.samples;
-				dimens[1] = frame.channels;
-				rg_samples.reset(new double[frame.samples *
-				    frame.channels]);
-				double_samples[0] = rg_samples.get();
-				double_samples[1] = double_samples[0] +
-				    frame.samples;
+			try {
+				if (!cache_keys.empty())
+					save_loudness(cache_path, cache_keys,
+					    gain_stats.get());
+			} catch (const Unix_error &e) {
+				// only a missed opportunity
+				std::lock_guard lock(output_mutex);
+				std::cerr << prog << ": " << e.what() << '\n';
 			}
-			transform_sample_fmt(frame, double_samples);
-			rg_analyzers.rbegin()->add(
-			    double_samples[0], double_samples[1], frame.samples
-			);
+		}
+	}
 
-			encoder->add_frame(frame);
-		} while (samples < track_samples);
+	// an archive entry's size comes first, so with --tar, every track is
+	// buffered
+	std::vector<std::unique_ptr<Memory_file>> buffers(offsets.size());
+	if ((options->buffer && !measured) || options->tar)
+		for (auto &buffer : buffers)
+			buffer.reset(new Memory_file);
+
+	// a buffered track, once tagged, goes to its file or the archive
+	auto write_out = [&](size_t i) {
+		Stage_timer timer(options->stats ?
+		    &track_stats[i][Stage::WRITE] : nullptr);
+		size_t bytes = buffers[i]->data().size();
+		if (options->tar)
+			options->tar->add(out_paths[i], buffers[i]->data());
+		else
+			buffers[i]->save(out_paths[i], options->output);
+		timer.stop(0, bytes);
+		// no need to hold on to it any longer
+		buffers[i].reset();
+	};
 
-		gain_stats.get()[i].track_gain = rg_analyzers.rbegin()->gain();
-		gain_stats.get()[i].track_peak = rg_analyzers.rbegin()->peak();
+	// already tagged, tracks can go into the archive as soon as they and
+	// the ones before them are done
+	std::mutex written_mutex;
+	std::vector<bool> done(offsets.size());
+	size_t written = 0;
+	auto track_done = [&](size_t i) {
+		if (!measured || !options->tar)
+			return;
+		std::lock_guard lock(written_mutex);
+		done[i] = true;
+		for (; written < done.size() && done[written]; written++)
+			write_out(written);
+	};
 
-		if (!encoder->finish()) {
-			std::cerr << prog << ": finish() failed\n";
+	if (!for_each_track(src_paths, options, last_track_frame,
+	    options->copy, [&](Track_source &source, size_t i) {
+		if (!split_track(source, offsets[i], *track_info[i],
+		    out_paths[i], options, buffers[i].get(),
+		    measured ? nullptr : &track_analyzers[i],
+		    measured ? &gain_stats.get()[i] : nullptr, analysis_pool,
+		    stats_for(i)))
 			return false;
-		}
-	}
+		track_done(i);
+		return true;
+	}))
+		return false;
 
-	double album_gain = replaygain::Analyzer::gain_multiple(rg_analyzers);
-	double album_peak = replaygain::Analyzer::peak_multiple(rg_analyzers);
+	if (measured) {
+		report();
+		return true;
+	}
 
-	for (unsigned i = 0; i < tracks; i++) {
-		gain_stats.get()[i].album_gain = album_gain;
-		gain_stats.get()[i].album_peak = album_peak;
+	compute_gain(track_analyzers, offsets, gain_stats.get());
 
-		// I hate these stupid mode strings; "r+b" = O_RDWR, binary
-		File_handle outfp(fopen(out_paths[i].c_str(), "r+b"));
-		if (!outfp) {
-			throw_traced(Unix_error(std::format(
-			    "open `{}' failed", out_paths[i].c_str())));
+	for (size_t i = 0; i < offsets.size(); i++) {
+		Stage_timer timer(options->stats ?
+		    &track_stats[i][Stage::TAG] : nullptr);
+
+		// a buffered track is tagged in memory, then written out
+		// whole; otherwise the file is reopened and tagged in place
+		File_handle outfp;
+		FILE *fp;
+		if (buffers[i]) {
+			fp = buffers[i]->fp();
+			rewind(fp);
+		} else {
+			// I hate these stupid mode strings; "r+b" = O_RDWR,
+			// binary
+			fp = outfp = fopen(out_paths[i].c_str(), "r+b");
+			if (!fp) {
+				throw_traced(Unix_error(std::format(
+				    "open `{}' failed", out_paths[i].c_str())));
+			}
 		}
 
-		Replaygain_writer writer(outfp);
-		writer.add_replaygain(gain_stats.get()[i]);
-		if (writer.check_if_tempfile_needed()) {
-			std::cerr << prog << ": padding exhausted for "
-			    << out_paths[i] << ", using temp file\n";
+		{
+			Replaygain_writer writer(fp);
+			writer.add_replaygain(gain_stats.get()[i]);
+			if (writer.check_if_tempfile_needed()) {
+				std::lock_guard lock(output_mutex);
+				std::cerr << prog << ": padding exhausted for "
+				    << out_paths[i] << ", using temp file\n";
+			}
+			writer.save();
 		}
-		writer.save();
+		timer.stop();
+
+		if (buffers[i])
+			write_out(i);
 	}
 
+	report();
 	return true;
 }
 
-void
-transform_sample_fmt(const Frame &frame, double **out) {
-	int shamt = -(frame.bits_per_sample - 1);
+Cd *
+parse_cue(const std::filesystem::path &cue_path) {
+	std::lock_guard lock(cue_mutex);
+	int fmt = CUE;
+	return cf_parse(const_cast<char *>(cue_path.c_str()), &fmt);
+}
 
-	for (int c = 0; c < frame.channels; c++) {
-		const int32_t	*channel_in = frame.data[c];
-		double		*channel_out = out[c];
-		for (int s = 0; s < frame.samples; s++) {
-			// Scale to [-1.0, 1.0].
-			double samplef = static_cast<double>(channel_in[s]);
-			samplef = ldexp(samplef, shamt);
-			channel_out[s] = samplef;
+//! Split one album, reporting rather than propagating any failure.
+bool
+split_album(const std::filesystem::path &cue_path,
+    const struct options *options) noexcept {
+	try {
+		return once(cue_path, options);
+	} catch (const std::exception &e) {
+		std::lock_guard lock(output_mutex);
+		std::cerr << prog << ": "  << e.what() << '\n';
+		const boost::stacktrace::stacktrace *st =
+		    boost::get_error_info<traced>(e);
+		if (st)
+			std::cerr << *st << '\n';
+		return false;
+	}
+}
+
+//! Split each album, running as many at once as the thread budget allows.
+//! Albums are started longest first so that a long one isn't left running
+//! by itself at the end.
+//! \return	the number of albums that failed
+size_t
+split_albums(const std::vector<std::string> &cuefiles,
+    const struct options *options) {
+	unsigned album_jobs = std::min<size_t>(options->jobs, cuefiles.size());
+	*options->spare_threads = options->jobs - album_jobs;
+
+	std::vector<std::pair<double, size_t>> order;
+	for (size_t i = 0; i < cuefiles.size(); i++) {
+		double seconds = album_jobs > 1 ?
+		    estimate_duration(cuefiles[i], options->use_flac) : 0;
+		order.emplace_back(seconds, i);
+	}
+	std::stable_sort(order.begin(), order.end(),
+	    [](const auto &a, const auto &b) {
+		return a.first > b.first;
+	    });
+
+	// not vector<bool>; each worker writes its own elements
+	std::unique_ptr<bool[]> ok(new bool[cuefiles.size()]());
+	std::atomic<size_t> next_album = 0;
+	run_parallel(album_jobs, [&]() {
+		size_t i;
+		while ((i = next_album++) < order.size()) {
+			size_t album = order[i].second;
+			ok[album] = split_album(cuefiles[album], options);
 		}
+		return true;
+	});
+
+	size_t failures = 0;
+	for (size_t i = 0; i < cuefiles.size(); i++) {
+		if (!ok[i])
+			failures++;
+		if (cuefiles.size() > 1)
+			*progress << (ok[i] ? "ok     " : "FAILED ")
+			    << cuefiles[i] << '\n';
 	}
+	if (failures && cuefiles.size() > 1)
+		std::cerr << prog << ": " << failures << " of "
+		    << cuefiles.size() << " albums failed\n";
+	return failures;
 }
 
 void
@@ -619,14 +1366,66 @@ main(int argc, char **argv) {
 
 	po::options_description visible_desc("Options");
 	visible_desc.add_options()
+	    ("apodization", po::value<std::string>(),
+		"FLAC apodization functions, as flac's -A")
+	    ("blocksize", po::value<unsigned>(),
+		"FLAC block size in samples (16 to 65535); over 4608, the "
+		"files are outside FLAC's streamable subset")
+	    ("buffer", "keep encoded tracks in memory until their ReplayGain "
+		"tags are known, so each file is written just once")
+	    ("compression", po::value<unsigned>(),
+		"FLAC compression level, 0 (fastest) to 8 (smallest); without "
+		"this, 8 with an exhaustive model search")
+	    ("copy", "split FLAC files by copying their frames instead of "
+		"encoding them again, where the track boundaries allow")
+	    ("decode_ahead", po::value<unsigned>()->default_value(0),
+		"decode up to this many frames ahead on a separate thread, "
+		"alongside encoding; with --pipeline, the loudness analyzer "
+		"shares them instead of copying them")
+	    ("direct_io", "write files around the page cache (O_DIRECT), "
+		"where the filesystem allows")
+	    ("drop_cache", "drop written files from the page cache")
+	    ("encoder_threads", po::value<unsigned>()->default_value(1),
+		"threads to encode each FLAC track with at most, for long "
+		"tracks that --jobs can't spread, taken from those --jobs "
+		"leaves idle (0 for one per CPU); needs libFLAC 1.5.0 or "
+		"later")
+	    ("exhaustive", "do an exhaustive model search even with "
+		"--compression or --fast")
+	    ("fast", "same as --compression 0")
 	    ("help", "show this message")
 	    ("hidden_track", "interpret initial pregap as a separate track")
+	    ("input", po::value<std::string>(),
+		"read the audio from this file instead of the one the cue "
+		"sheet names, e.g. a pipe (`-' for standard input); it's "
+		"split as it's read, one track at a time")
+	    ("jobs,j", po::value<unsigned>()->default_value(1),
+		"number of tracks to encode at once, across all albums (0 for "
+		"one per CPU)")
+	    ("pipeline", "measure loudness on a separate thread, alongside "
+		"encoding")
+	    ("preallocate", "reserve disk space for each file up front, "
+		"from an estimate of its size")
+	    ("prescan", "measure loudness in a pass of its own, before "
+		"encoding, so tracks are tagged as they're written; the "
+		"results are cached next to the cue sheet for next time")
+	    ("read_size", po::value<unsigned>()->default_value(75),
+		"how much of a WAV file to read at a time, in CD frames "
+		"(1/75 s)")
+	    ("write_size", po::value<unsigned>()->default_value(1024),
+		"how much to write to a file at a time, in KiB")
 	    ("use_flac,f", "split a FLAC instead of WAV if available")
 	    ("outdir,O", po::value<std::string>(),
 		"parent directory to output to")
+	    ("stats", po::value<std::string>()->implicit_value("text"),
+		"report the time each stage of splitting takes, per track "
+		"and per album, as `text' (the default) or `json'")
 	    ("switch_index,i", "use INDEX 00 for splitting instead of 01 "
 		"(most CD players seek to INDEX 01 instead of INDEX 00 if "
 		"available, but some CDs don't play by those rules)")
+	    ("tar", "write the tracks to standard output as a tar archive, "
+		"instead of to files; each is held in memory until its "
+		"ReplayGain tags are known")
 	    ;
 
 	po::options_description hidden_desc;
@@ -654,6 +1453,9 @@ main(int argc, char **argv) {
 		std::cerr << prog << ": unknown option `"
 		    << e.get_option_name() << "'\n";
 		return 1;
+	} catch (const po::error &e) {
+		std::cerr << prog << ": " << e.what() << '\n';
+		return 1;
 	}
 
 	if (argc < 2) {
@@ -682,29 +1484,178 @@ main(int argc, char **argv) {
 			out_dir = opt.as<std::string>();
 	}
 
+	std::string input;
+	{
+		const po::variable_value &opt = var_map["input"];
+		if (!opt.empty())
+			input = opt.as<std::string>();
+	}
+
+	bool buffer = !var_map["buffer"].empty();
+	bool copy = !var_map["copy"].empty();
 	bool hidden_track = !var_map["hidden_track"].empty();
 	bool switch_index = !var_map["switch_index"].empty();
 	bool use_flac = !var_map["use_flac"].empty();
+	bool pipeline = !var_map["pipeline"].empty();
+	bool prescan = !var_map["prescan"].empty();
+	bool tar = !var_map["tar"].empty();
+
+	std::optional<Stats_format> stats;
+	{
+		const po::variable_value &opt = var_map["stats"];
+		if (!opt.empty()) {
+			const std::string &format = opt.as<std::string>();
+			if (format == "text")
+				stats = Stats_format::TEXT;
+			else if (format == "json")
+				stats = Stats_format::JSON;
+			else {
+				std::cerr << prog << ": unknown stats format `"
+				    << format << "'\n";
+				return 1;
+			}
+		}
+	}
+
+	unsigned jobs = var_map["jobs"].as<unsigned>();
+	if (!jobs)
+		jobs = std::max(std::thread::hardware_concurrency(), 1U);
+
+	if (!input.empty()) {
+		if (cuefiles.size() > 1) {
+			std::cerr << prog << ": --input takes a single cue "
+			    "sheet\n";
+			return 1;
+		}
+		// both need to read the source more than once
+		if (prescan || copy) {
+			std::cerr << prog << ": --input conflicts with "
+			    << (prescan ? "--prescan" : "--copy") << '\n';
+			return 1;
+		}
+		// a stream can't be shared
+		jobs = 1;
+	}
+
+	unsigned decode_ahead = var_map["decode_ahead"].as<unsigned>();
+
+	unsigned read_frames = var_map["read_size"].as<unsigned>();
+	if (!read_frames) {
+		std::cerr << prog << ": read size must be positive\n";
+		return 1;
+	}
+
+	// with no level given, it's --best and then some, as it always was
+	Encode_options encode;
+	{
+		const po::variable_value &compression =
+		    var_map["compression"];
+		bool fast = !var_map["fast"].empty();
+		if (!compression.empty() && fast) {
+			std::cerr << prog << ": --compression and --fast "
+			    "conflict\n";
+			return 1;
+		}
+		if (!compression.empty()) {
+			encode.compression_level = compression.as<unsigned>();
+			if (encode.compression_level > 8) {
+				std::cerr << prog << ": compression level "
+				    "must be from 0 to 8\n";
+				return 1;
+			}
+			encode.exhaustive_search = false;
+		} else if (fast) {
+			encode.compression_level = 0;
+			encode.exhaustive_search = false;
+		}
+		if (!var_map["exhaustive"].empty())
+			encode.exhaustive_search = true;
+
+		const po::variable_value &apodization =
+		    var_map["apodization"];
+		if (!apodization.empty())
+			encode.apodization = apodization.as<std::string>();
+
+		encode.threads = var_map["encoder_threads"].as<unsigned>();
+		if (!encode.threads)
+			encode.threads = std::max(
+			    std::thread::hardware_concurrency(), 1U);
+		if (encode.threads > 1) {
+			unsigned max_threads = max_encoder_threads(
+			    encode.threads);
+			if (max_threads == 1)
+				std::cerr << prog << ": this libFLAC can't "
+				    "encode with threads; ignoring "
+				    "--encoder_threads\n";
+			else if (max_threads < encode.threads)
+				std::cerr << prog << ": libFLAC encodes with "
+				    "at most " << max_threads << " threads\n";
+			encode.threads = max_threads;
+		}
+
+		const po::variable_value &blocksize = var_map["blocksize"];
+		if (!blocksize.empty()) {
+			encode.blocksize = blocksize.as<unsigned>();
+			if (encode.blocksize < 16 ||
+			    encode.blocksize > 65535) {
+				std::cerr << prog << ": block size must be "
+				    "from 16 to 65535\n";
+				return 1;
+			}
+		}
+	}
+
+	Output_options output;
+	output.buffer_size = static_cast<size_t>(
+	    var_map["write_size"].as<unsigned>()) * 1024;
+	if (!output.buffer_size) {
+		std::cerr << prog << ": write size must be positive\n";
+		return 1;
+	}
+	output.preallocate = !var_map["preallocate"].empty();
+	output.drop_cache = !var_map["drop_cache"].empty();
+	output.direct = !var_map["direct_io"].empty();
+
+	std::counting_semaphore<> budget(jobs);
+	std::atomic<unsigned> spare_threads = 0;
+
+	// stdout is the archive's, so the progress goes to stderr
+	std::optional<Tar_writer> tar_writer;
+	if (tar) {
+		progress = &std::cerr;
+		setvbuf(stdout, nullptr, _IOFBF, output.buffer_size);
+		tar_writer.emplace(stdout);
+	}
 
 	options opts = {
 		.out_dir=out_dir,
+		.budget=&budget,
+		.buffer=buffer,
+		.copy=copy,
+		.decode_ahead=decode_ahead,
+		.encode=encode,
 		.hidden_track=hidden_track,
+		.input=input,
+		.jobs=jobs,
+		.output=output,
+		.pipeline=pipeline,
+		.prescan=prescan,
+		.read_frames=read_frames,
+		.spare_threads=&spare_threads,
+		.stats=stats,
 		.switch_index=switch_index,
+		.tar=tar_writer ? &*tar_writer : nullptr,
 		.use_flac=use_flac,
 	};
 
-	for (auto &cuefile : cuefiles) {
+	size_t failures = split_albums(cuefiles, &opts);
+	if (tar_writer) {
 		try {
-			if (!once(cuefile, &opts))
-				return 1;
-		} catch (const std::exception &e) {
-			std::cerr << prog << ": "  << e.what() << '\n';
-			const boost::stacktrace::stacktrace *st =
-			    boost::get_error_info<traced>(e);
-			if (st)
-				std::cerr << *st << '\n';
+			tar_writer->finish();
+		} catch (const Unix_error &e) {
+			std::cerr << prog << ": " << e.what() << '\n';
 			return 1;
 		}
 	}
-	return 0;
+	return failures ? 1 : 0;
 }
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cstring>
+
+#include "md5.hpp"
+
+namespace {
+
+// per-round shift amounts
+const uint8_t SHIFTS[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+// floor(abs(sin(i + 1)) * 2^32)
+const uint32_t SINES[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+inline uint32_t
+rotl(uint32_t x, unsigned n) {
+	return x << n | x >> (32 - n);
+}
+
+} // end anon
+
+flacsplit::Md5::Md5() :
+	_state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476},
+	_len(0),
+	_buffer()
+{}
+
+void
+flacsplit::Md5::update(const void *data, size_t len) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	size_t used = _len % 64;
+	_len += len;
+
+	if (used) {
+		size_t n = std::min(len, 64 - used);
+		memcpy(_buffer + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		transform(_buffer);
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		transform(p);
+	memcpy(_buffer, p, len);
+}
+
+std::array<uint8_t, 16>
+flacsplit::Md5::digest() {
+	uint64_t bits = _len * 8;
+	uint8_t pad[72] = {0x80};
+	size_t used = _len % 64;
+	size_t pad_len = (used < 56 ? 56 : 120) - used;
+	for (int i = 0; i < 8; i++)
+		pad[pad_len + i] = bits >> 8 * i;
+	update(pad, pad_len + 8);
+
+	std::array<uint8_t, 16> result;
+	for (int i = 0; i < 16; i++)
+		result[i] = _state[i / 4] >> 8 * (i % 4);
+	return result;
+}
+
+void
+flacsplit::Md5::transform(const uint8_t *block) {
+	uint32_t m[16];
+	for (int i = 0; i < 16; i++)
+		m[i] = static_cast<uint32_t>(block[i*4]) |
+		    static_cast<uint32_t>(block[i*4 + 1]) << 8 |
+		    static_cast<uint32_t>(block[i*4 + 2]) << 16 |
+		    static_cast<uint32_t>(block[i*4 + 3]) << 24;
+
+	uint32_t a = _state[0];
+	uint32_t b = _state[1];
+	uint32_t c = _state[2];
+	uint32_t d = _state[3];
+	for (unsigned i = 0; i < 64; i++) {
+		uint32_t f;
+		unsigned g;
+		switch (i / 16) {
+		case 0:
+			f = (b & c) | (~b & d);
+			g = i;
+			break;
+		case 1:
+			f = (d & b) | (~d & c);
+			g = (5*i + 1) % 16;
+			break;
+		case 2:
+			f = b ^ c ^ d;
+			g = (3*i + 5) % 16;
+			break;
+		default:
+			f = c ^ (b | ~d);
+			g = 7*i % 16;
+		}
+		f += a + SINES[i] + m[g];
+		a = d;
+		d = c;
+		c = b;
+		b += rotl(f, SHIFTS[i]);
+	}
+	_state[0] += a;
+	_state[1] += b;
+	_state[2] += c;
+	_state[3] += d;
+}
@@ -0,0 +1,31 @@
+#ifndef FLACSPLIT_MD5_HPP
+#define FLACSPLIT_MD5_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace flacsplit {
+
+/** MD5 (RFC 1321), for the audio signature in a FLAC STREAMINFO block when
+ * the FLAC encoder isn't there to compute it. */
+class Md5 {
+public:
+	Md5();
+
+	void update(const void *data, size_t len);
+
+	//! The digest of everything so far; update() can't be called after.
+	std::array<uint8_t, 16> digest();
+
+private:
+	void transform(const uint8_t *block);
+
+	uint32_t	_state[4];
+	uint64_t	_len;
+	uint8_t		_buffer[64];
+};
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include <iomanip>
+#include <sstream>
+
+#include "stats.hpp"
+
+namespace {
+
+const char *const STAGE_NAMES[flacsplit::STAGES] = {
+	"decode", "analyze", "encode", "tag", "write", "mkdir",
+};
+
+double
+seconds_between(const struct timespec &begin, const struct timespec &end) {
+	return (end.tv_sec - begin.tv_sec) +
+	    (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+//! Per second of wall time, or 0 if no time passed.
+double
+rate(uint64_t count, double wall) {
+	return wall > 0 ? count / wall : 0;
+}
+
+std::string
+json_string(const std::string &s) {
+	std::ostringstream out;
+	out << '"';
+	for (unsigned char c : s) {
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (c < 0x20)
+			out << "\\u" << std::hex << std::setw(4)
+			    << std::setfill('0') << static_cast<unsigned>(c)
+			    << std::dec;
+		else
+			out << c;
+	}
+	out << '"';
+	return out.str();
+}
+
+void
+write_stage_text(std::ostream &out, const char *name,
+    const flacsplit::Stage_stats &stage) {
+	out << "    " << std::left << std::setw(8) << name << std::right
+	    << std::setw(9) << stage.wall << " s wall "
+	    << std::setw(9) << stage.cpu << " s cpu";
+	if (stage.samples)
+		out << std::setw(9) << rate(stage.samples, stage.wall) /
+		    1e6 << " Msamples/s";
+	if (stage.bytes)
+		out << std::setw(9) << rate(stage.bytes, stage.wall) /
+		    1e6 << " MB/s";
+	out << '\n';
+}
+
+void
+write_split_text(std::ostream &out, const std::string &name,
+    const flacsplit::Split_stats &stats,
+    const flacsplit::Stage_stats *total) {
+	out << "  " << name << '\n';
+	for (size_t i = 0; i < flacsplit::STAGES; i++)
+		if (stats.stages[i].wall > 0)
+			write_stage_text(out, STAGE_NAMES[i],
+			    stats.stages[i]);
+	if (total)
+		write_stage_text(out, "total", *total);
+}
+
+void
+write_stage_json(std::ostream &out, const flacsplit::Stage_stats &stage) {
+	out << "{\"wall\":" << stage.wall
+	    << ",\"cpu\":" << stage.cpu
+	    << ",\"samples\":" << stage.samples
+	    << ",\"bytes\":" << stage.bytes
+	    << ",\"samples_per_sec\":" << rate(stage.samples, stage.wall)
+	    << ",\"bytes_per_sec\":" << rate(stage.bytes, stage.wall)
+	    << '}';
+}
+
+void
+write_split_json(std::ostream &out, const flacsplit::Split_stats &stats) {
+	out << '{';
+	bool first = true;
+	for (size_t i = 0; i < flacsplit::STAGES; i++) {
+		if (!(stats.stages[i].wall > 0))
+			continue;
+		if (!first)
+			out << ',';
+		first = false;
+		out << '"' << STAGE_NAMES[i] << "\":";
+		write_stage_json(out, stats.stages[i]);
+	}
+	out << '}';
+}
+
+} // end anon
+
+flacsplit::Stage_stats &
+flacsplit::Stage_stats::operator+=(const Stage_stats &rhs) {
+	wall += rhs.wall;
+	cpu += rhs.cpu;
+	samples += rhs.samples;
+	bytes += rhs.bytes;
+	return *this;
+}
+
+flacsplit::Split_stats &
+flacsplit::Split_stats::operator+=(const Split_stats &rhs) {
+	for (size_t i = 0; i < STAGES; i++)
+		stages[i] += rhs.stages[i];
+	return *this;
+}
+
+flacsplit::Stage_timer::Stage_timer(Stage_stats *stats) noexcept :
+	_stats(stats),
+	_wall(),
+	_cpu()
+{
+	if (!_stats)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &_wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &_cpu);
+}
+
+void
+flacsplit::Stage_timer::stop(uint64_t samples, uint64_t bytes) noexcept {
+	if (!_stats)
+		return;
+	struct timespec wall, cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	_stats->wall += seconds_between(_wall, wall);
+	_stats->cpu += seconds_between(_cpu, cpu);
+	_stats->samples += samples;
+	_stats->bytes += bytes;
+	_stats = nullptr;
+}
+
+void
+flacsplit::write_stats(std::ostream &out, Stats_format format,
+    const std::string &album, const std::vector<std::string> &track_names,
+    const std::vector<Split_stats> &tracks, const Split_stats &album_stats,
+    const Stage_stats &total) {
+	Split_stats sum = album_stats;
+	for (auto &track : tracks)
+		sum += track;
+
+	// all at once, since other albums may be reporting, too
+	std::ostringstream buf;
+	buf << std::fixed << std::setprecision(3);
+	if (format == Stats_format::TEXT) {
+		buf << "stats for " << album << ":\n";
+		for (size_t i = 0; i < tracks.size(); i++)
+			write_split_text(buf, track_names[i], tracks[i],
+			    nullptr);
+		write_split_text(buf, "album", sum, &total);
+	} else {
+		buf << "{\"album\":" << json_string(album)
+		    << ",\"tracks\":[";
+		for (size_t i = 0; i < tracks.size(); i++) {
+			if (i)
+				buf << ',';
+			buf << "{\"name\":" << json_string(track_names[i])
+			    << ",\"stages\":";
+			write_split_json(buf, tracks[i]);
+			buf << '}';
+		}
+		buf << "],\"stages\":";
+		write_split_json(buf, sum);
+		buf << ",\"total\":";
+		write_stage_json(buf, total);
+		buf << "}\n";
+	}
+	out << buf.str() << std::flush;
+}
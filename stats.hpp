@@ -0,0 +1,105 @@
+#ifndef FLACSPLIT_STATS_HPP
+#define FLACSPLIT_STATS_HPP
+
+#include <time.h>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace flacsplit {
+
+//! The stages that splitting is timed in, with --stats.
+enum class Stage {
+	//! Reading the source and converting it to samples
+	DECODE,
+	//! Measuring loudness
+	ANALYZE,
+	//! Encoding, or with --copy, copying (which decodes, too)
+	ENCODE,
+	//! Adding ReplayGain tags to a finished track
+	TAG,
+	//! Writing a track out: closing its file, or saving it from memory
+	WRITE,
+	//! Creating the album's directories
+	MKDIR,
+};
+
+const size_t STAGES = static_cast<size_t>(Stage::MKDIR) + 1;
+
+//! Time spent in, and work done by, one stage.
+struct Stage_stats {
+	//! In seconds
+	double		wall = 0;
+	//! In seconds, of whichever thread did the work
+	double		cpu = 0;
+	uint64_t	samples = 0;
+	uint64_t	bytes = 0;
+
+	Stage_stats &operator+=(const Stage_stats &);
+};
+
+//! The stages of one track, or of a whole album.
+struct Split_stats {
+	Stage_stats &operator[](Stage stage) {
+		return stages[static_cast<size_t>(stage)];
+	}
+
+	const Stage_stats &operator[](Stage stage) const {
+		return stages[static_cast<size_t>(stage)];
+	}
+
+	Split_stats &operator+=(const Split_stats &);
+
+	Stage_stats	stages[STAGES];
+};
+
+/** Times a stage from construction to stop() (or destruction), by the
+ * monotonic clock and the calling thread's CPU clock, and adds it to a
+ * Stage_stats. Given null, it does nothing, so that timing can be left in
+ * place when it isn't wanted.
+ */
+class Stage_timer {
+public:
+	explicit Stage_timer(Stage_stats *stats) noexcept;
+
+	Stage_timer(const Stage_timer &) = delete;
+	void operator=(const Stage_timer &) = delete;
+
+	~Stage_timer() {
+		stop();
+	}
+
+	//! Stop timing, and count \a samples and \a bytes as done; only the
+	//! first call counts.
+	void stop(uint64_t samples=0, uint64_t bytes=0) noexcept;
+
+private:
+	Stage_stats	*_stats;
+	struct timespec	_wall;
+	struct timespec	_cpu;
+};
+
+enum class Stats_format {
+	TEXT,
+	//! One object per album, on a line of its own
+	JSON,
+};
+
+/** Report an album's stats, track by track.
+ *
+ * \param album		What to call the album
+ * \param track_names	One for each of \a tracks
+ * \param album_stats	Stages that aren't any one track's; the album's
+ *	totals are these plus every track's
+ * \param total		The album from start to finish
+ */
+void write_stats(std::ostream &out, Stats_format format,
+    const std::string &album, const std::vector<std::string> &track_names,
+    const std::vector<Split_stats> &tracks, const Split_stats &album_stats,
+    const Stage_stats &total);
+
+}
+
+#endif
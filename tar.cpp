@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#include "errors.hpp"
+#include "tar.hpp"
+
+namespace {
+
+const size_t BLOCK_SIZE = 512;
+
+// what fits in a ustar header's 12-byte size field, in octal
+const uint64_t USTAR_MAX_SIZE = (UINT64_C(1) << 33) - 1;
+
+//! Split \a name into the ustar header's prefix and name fields, at a slash,
+//! if it fits.
+bool
+ustar_split(const std::string &name, std::string *prefix, std::string *base) {
+	if (name.size() <= 100) {
+		prefix->clear();
+		*base = name;
+		return true;
+	}
+	// the earliest slash that leaves no more than 100 bytes after it
+	size_t slash = name.find('/', name.size() - 101);
+	if (slash == std::string::npos || slash > 155)
+		return false;
+	*prefix = name.substr(0, slash);
+	*base = name.substr(slash + 1);
+	return !base->empty();
+}
+
+//! A pax extended header record, "<length> <key>=<value>\n", where the
+//! length counts its own digits.
+std::string
+pax_record(const std::string &key, const std::string &value) {
+	size_t len = key.size() + value.size() + 3;
+	size_t digits = std::to_string(len).size();
+	if (std::to_string(len + digits).size() > digits)
+		digits++;
+	return std::to_string(len + digits) + ' ' + key + '=' + value +
+	    '\n';
+}
+
+//! Fill a numeric header field with octal digits and a NUL.
+void
+set_octal(char *field, size_t len, uint64_t value) {
+	for (size_t i = len - 1; i--; value >>= 3)
+		field[i] = '0' + (value & 7);
+	field[len - 1] = '\0';
+}
+
+} // end anon
+
+flacsplit::Tar_writer::Tar_writer(FILE *fp) :
+	_mutex(),
+	_fp(fp)
+{}
+
+void
+flacsplit::Tar_writer::add(const std::filesystem::path &path,
+    const std::vector<uint8_t> &data) {
+	std::string name = path.relative_path().generic_string();
+
+	std::lock_guard lock(_mutex);
+
+	// what ustar can't hold goes in a pax header first
+	std::string prefix, base;
+	std::string records;
+	if (!ustar_split(name, &prefix, &base))
+		records += pax_record("path", name);
+	if (data.size() > USTAR_MAX_SIZE)
+		records += pax_record("size", std::to_string(data.size()));
+	if (!records.empty()) {
+		write_header("PaxHeader", records.size(), 'x');
+		write(records.data(), records.size());
+	}
+
+	write_header(name, data.size(), '0');
+	write(data.data(), data.size());
+}
+
+void
+flacsplit::Tar_writer::finish() {
+	std::lock_guard lock(_mutex);
+
+	static const char zeros[2 * BLOCK_SIZE] = {};
+	write(zeros, sizeof(zeros));
+	if (fflush(_fp))
+		throw_traced(Unix_error("write to archive failed"));
+}
+
+void
+flacsplit::Tar_writer::write(const void *buf, size_t len) {
+	static const char zeros[BLOCK_SIZE] = {};
+	// everything is padded to whole blocks
+	size_t pad = -len % BLOCK_SIZE;
+	if (fwrite(buf, 1, len, _fp) != len ||
+	    fwrite(zeros, 1, pad, _fp) != pad)
+		throw_traced(Unix_error("write to archive failed"));
+}
+
+void
+flacsplit::Tar_writer::write_header(const std::string &name, uint64_t size,
+    char type) {
+	char header[BLOCK_SIZE] = {};
+
+	std::string prefix, base;
+	// with a pax path, this is just for older tars
+	if (!ustar_split(name, &prefix, &base)) {
+		prefix.clear();
+		base = name.substr(name.size() - 100);
+	}
+	memcpy(header, base.data(), base.size());
+	set_octal(header + 100, 8, 0644);
+	set_octal(header + 108, 8, 0);
+	set_octal(header + 116, 8, 0);
+	set_octal(header + 124, 12, std::min(size, USTAR_MAX_SIZE));
+	set_octal(header + 136, 12, time(nullptr));
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	memcpy(header + 345, prefix.data(), prefix.size());
+
+	// summed with the checksum field as spaces
+	memset(header + 148, ' ', 8);
+	unsigned sum = 0;
+	for (unsigned char c : header)
+		sum += c;
+	set_octal(header + 148, 7, sum);
+
+	write(header, sizeof(header));
+}
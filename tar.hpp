@@ -0,0 +1,51 @@
+#ifndef FLACSPLIT_TAR_HPP
+#define FLACSPLIT_TAR_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace flacsplit {
+
+/** Writes files into a POSIX (pax) tar archive on a stream, e.g. stdout, as
+ * they're finished. Entries may be added from any thread; each is written
+ * whole before the next begins.
+ */
+class Tar_writer {
+public:
+	//! \param fp	Still the caller's to close
+	Tar_writer(FILE *fp);
+
+	Tar_writer(const Tar_writer &) = delete;
+	void operator=(const Tar_writer &) = delete;
+
+	/** Add a regular file. A leading / is dropped from \a path, as tar
+	 * does.
+	 *
+	 * \throw Unix_error
+	 */
+	void add(const std::filesystem::path &path,
+	    const std::vector<uint8_t> &data);
+
+	//! End the archive, and flush it.
+	//! \throw Unix_error
+	void finish();
+
+private:
+	//! \throw Unix_error
+	void write(const void *, size_t);
+
+	//! \throw Unix_error
+	void write_header(const std::string &name, uint64_t size,
+	    char type);
+
+	std::mutex	_mutex;
+	FILE		*_fp;
+};
+
+}
+
+#endif
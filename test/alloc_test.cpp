@@ -0,0 +1,318 @@
+// Checks that the sample path doesn't touch the heap once it's going: a
+// WAVE or FLAC file decoded, in place or ahead into pooled buffers, and
+// handed through a Frame_ring (as to the loudness analyzer) either copied or
+// pinned, then analyzed and encoded; and a FLAC file split by copying its
+// frames, each handed through a ring sized by the copier. Only allocations
+// through operator new are counted; the C libraries' own, libFLAC's and
+// libebur128's, aren't.
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <FLAC++/encoder.h>
+#include <cuetools/cdtext.h>
+
+#include "decode.hpp"
+#include "encode.hpp"
+#include "flac_copy.hpp"
+#include "frame_pool.hpp"
+#include "frame_ring.hpp"
+#include "loudness.hpp"
+
+namespace {
+
+std::atomic<uint64_t>	allocations;
+
+const unsigned	CHANNELS = 2;
+const unsigned	RATE = 44100;
+// at --read_size 1, a frame is a CD frame of 588 samples, and the FLAC file
+// is written with blocks of the same size
+const unsigned	FRAME_SAMPLES = 588;
+const int64_t	WARM_UP_FRAMES = 50;
+const int64_t	FRAMES = 1000;
+const int64_t	SAMPLES = (WARM_UP_FRAMES + FRAMES + 1) * FRAME_SAMPLES;
+
+//! The test signal, a ramp with the channels a sample apart.
+int32_t
+sample(int64_t i, unsigned channel) {
+	return static_cast<int16_t>(i + channel);
+}
+
+void
+put_le(FILE *fp, uint32_t value, unsigned bytes) {
+	for (unsigned i = 0; i < bytes; i++)
+		putc(value >> (8 * i) & 0xff, fp);
+}
+
+//! A temporary 16-bit stereo WAVE file of the test signal.
+FILE *
+make_wave() {
+	FILE *fp = tmpfile();
+	if (!fp) {
+		perror("tmpfile");
+		exit(2);
+	}
+	uint32_t data_len = SAMPLES * CHANNELS * 2;
+	fputs("RIFF", fp);
+	put_le(fp, 36 + data_len, 4);
+	fputs("WAVEfmt ", fp);
+	put_le(fp, 16, 4);
+	put_le(fp, 1, 2);
+	put_le(fp, CHANNELS, 2);
+	put_le(fp, RATE, 4);
+	put_le(fp, RATE * CHANNELS * 2, 4);
+	put_le(fp, CHANNELS * 2, 2);
+	put_le(fp, 16, 2);
+	fputs("data", fp);
+	put_le(fp, data_len, 4);
+	for (int64_t i = 0; i < SAMPLES; i++)
+		for (unsigned c = 0; c < CHANNELS; c++)
+			put_le(fp, sample(i, c), 2);
+	fflush(fp);
+	rewind(fp);
+	return fp;
+}
+
+//! A temporary 16-bit stereo FLAC file of the test signal.
+FILE *
+make_flac() {
+	char path[] = "/tmp/alloc_test-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(2);
+	}
+	close(fd);
+
+	FLAC::Encoder::File encoder;
+	encoder.set_channels(CHANNELS);
+	encoder.set_bits_per_sample(16);
+	encoder.set_sample_rate(RATE);
+	encoder.set_compression_level(0);
+	encoder.set_blocksize(FRAME_SAMPLES);
+	if (encoder.init(path) != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+		std::cerr << "can't write " << path << '\n';
+		exit(2);
+	}
+	std::vector<FLAC__int32> block(FRAME_SAMPLES * CHANNELS);
+	for (int64_t i = 0; i < SAMPLES; i += FRAME_SAMPLES) {
+		for (unsigned j = 0; j < FRAME_SAMPLES; j++)
+			for (unsigned c = 0; c < CHANNELS; c++)
+				block[j * CHANNELS + c] = sample(i + j, c);
+		encoder.process_interleaved(block.data(), FRAME_SAMPLES);
+	}
+	if (!encoder.finish()) {
+		std::cerr << "can't write " << path << '\n';
+		exit(2);
+	}
+
+	FILE *fp = fopen(path, "rb");
+	unlink(path);
+	if (!fp) {
+		perror(path);
+		exit(2);
+	}
+	return fp;
+}
+
+struct Case {
+	const char			*name;
+	flacsplit::file_format		format;
+	unsigned			ahead;
+	bool				pin;
+	// by the thread draining the ring
+	bool				analyze;
+	bool				encode;
+};
+
+/** Decode, and push every frame through a ring that another thread drains,
+ * encoding and analyzing them as \a c says.
+ *
+ * \return	How many allocations there were after the warm-up
+ */
+uint64_t
+run(const Case &c) {
+	FILE *fp = c.format == flacsplit::file_format::FLAC ? make_flac() :
+	    make_wave();
+	flacsplit::Decoder decoder(fp, c.format, 1, c.ahead);
+	flacsplit::Frame_pool pool(8, decoder.max_frame_len());
+	flacsplit::Frame_ring ring(8, pool);
+
+	std::optional<flacsplit::replaygain::Analyzer> analyzer;
+	if (c.analyze)
+		analyzer.emplace(CHANNELS, RATE);
+
+	std::unique_ptr<FILE, decltype(&fclose)> out(nullptr, &fclose);
+	std::unique_ptr<Cdtext, decltype(&cdtext_delete)> cdtext(nullptr,
+	    &cdtext_delete);
+	std::optional<flacsplit::Music_info> track;
+	std::optional<flacsplit::Encoder> encoder;
+	if (c.encode) {
+		out.reset(tmpfile());
+		cdtext.reset(cdtext_init());
+		if (!out || !cdtext) {
+			perror("tmpfile");
+			exit(2);
+		}
+		track.emplace(cdtext.get());
+		encoder.emplace(out.get(), *track,
+		    (WARM_UP_FRAMES + FRAMES) * FRAME_SAMPLES, RATE);
+	}
+
+	int64_t sum = 0;
+	std::thread consumer([&ring, &sum, &analyzer]() {
+		while (const flacsplit::Frame *frame = ring.front()) {
+			sum += frame->data[CHANNELS - 1][0];
+			if (analyzer)
+				analyzer->add(frame->data, frame->samples,
+				    frame->bits_per_sample);
+			ring.pop();
+		}
+	});
+
+	uint64_t before = 0;
+	for (int64_t i = 0; i < WARM_UP_FRAMES + FRAMES; i++) {
+		if (i == WARM_UP_FRAMES)
+			before = allocations;
+		flacsplit::Frame frame = decoder.next_frame(false);
+		ring.push(frame, c.pin ? decoder.pin() : flacsplit::Frame_ref());
+		if (encoder)
+			encoder->add_frame(frame);
+	}
+	uint64_t after = allocations;
+
+	ring.close();
+	consumer.join();
+	if (encoder)
+		encoder->finish();
+	return after - before;
+}
+
+/** Copy the FLAC file as one track, and push every frame that the copier
+ * hands back through a ring whose pool is reserved, as with --copy
+ * --pipeline, from the copier's max_frame_len().
+ *
+ * \param[out] oversized	How many frames the pool wasn't reserved for
+ * \return	How many allocations pushing them took after the warm-up
+ */
+uint64_t
+run_copy(int64_t &oversized) {
+	std::unique_ptr<FILE, decltype(&fclose)> in(make_flac(), &fclose);
+	std::unique_ptr<flacsplit::Flac_copier> copier =
+	    flacsplit::Flac_copier::open(in.get(), flacsplit::Encode_options());
+	if (!copier) {
+		std::cerr << "can't copy from the FLAC file\n";
+		exit(2);
+	}
+	flacsplit::Frame_pool pool(8);
+	pool.reserve(copier->max_frame_len());
+	flacsplit::Frame_ring ring(8, pool);
+
+	std::unique_ptr<FILE, decltype(&fclose)> out(tmpfile(), &fclose);
+	std::unique_ptr<Cdtext, decltype(&cdtext_delete)> cdtext(cdtext_init(),
+	    &cdtext_delete);
+	if (!out || !cdtext) {
+		perror("tmpfile");
+		exit(2);
+	}
+	flacsplit::Music_info track(cdtext.get());
+
+	int64_t sum = 0;
+	std::thread consumer([&ring, &sum]() {
+		while (const flacsplit::Frame *frame = ring.front()) {
+			sum += frame->data[CHANNELS - 1][0];
+			ring.pop();
+		}
+	});
+
+	size_t max_len = copier->max_frame_len();
+	int64_t frames = 0;
+	uint64_t count = 0;
+	oversized = 0;
+	copier->copy(out.get(), 0, SAMPLES, track, nullptr,
+	    [&](const flacsplit::Frame &frame) {
+		if (static_cast<size_t>(frame.samples) * frame.channels >
+		    max_len)
+			oversized++;
+		uint64_t before = allocations;
+		ring.push(frame);
+		if (frames++ >= WARM_UP_FRAMES)
+			count += allocations - before;
+	});
+
+	ring.close();
+	consumer.join();
+	return count;
+}
+
+} // end anon
+
+void *
+operator new(size_t len) {
+	allocations++;
+	if (void *p = malloc(len ? len : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void
+operator delete(void *p) noexcept {
+	free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+int
+main() {
+	using flacsplit::file_format;
+
+	const Case cases[] = {
+		{"WAVE decoded in place, copied into the ring",
+		    file_format::WAVE, 0, false, false, false},
+		{"WAVE decoded ahead, copied into the ring",
+		    file_format::WAVE, 16, false, false, false},
+		{"WAVE decoded ahead, pinned in the ring",
+		    file_format::WAVE, 16, true, false, false},
+		{"FLAC decoded in place, copied into the ring",
+		    file_format::FLAC, 0, false, false, false},
+		{"FLAC decoded ahead, pinned in the ring",
+		    file_format::FLAC, 16, true, false, false},
+		{"WAVE decoded in place, analyzed and encoded",
+		    file_format::WAVE, 0, false, true, true},
+		{"FLAC decoded ahead, analyzed and encoded",
+		    file_format::FLAC, 16, true, true, true},
+	};
+
+	int failures = 0;
+	for (const Case &c : cases) {
+		uint64_t count = run(c);
+		std::cout << (count ? "FAIL " : "ok   ") << c.name << ": "
+		    << count << " allocations in " << FRAMES << " frames\n";
+		if (count)
+			failures++;
+	}
+
+	int64_t oversized;
+	uint64_t count = run_copy(oversized);
+	std::cout << (count || oversized ? "FAIL " : "ok   ")
+	    << "FLAC copied, copied into the ring: " << count
+	    << " allocations, " << oversized
+	    << " frames over max_frame_len()\n";
+	if (count || oversized)
+		failures++;
+	return failures ? 1 : 0;
+}